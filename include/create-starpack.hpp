@@ -6,6 +6,7 @@
 #include <utility> // for std::pair
 #include <ostream>
 #include <iostream>
+#include <mutex>
 
 // ---------------------------------------------------------------------------
 // ANSI Color Macros for Console Output
@@ -36,6 +37,160 @@ extern bool useFakeroot;
  */
 extern bool noStripping;
 
+/**
+ * @brief Whether byte-identical files in a package are left as separate copies.
+ *
+ * By default duplicates are replaced with hard links to a single copy, which tar
+ * stores as link entries. Settable via "--no-dedup".
+ */
+extern bool noDedup;
+
+/**
+ * @brief Number of parallel jobs exported to build scripts, overriding detection.
+ *
+ * 0 (the default) means the count is derived from the CPUs available to us, the
+ * cgroup CPU quota and available memory. Settable via "--jobs N".
+ */
+extern unsigned jobsOverride;
+
+/**
+ * @brief Estimated memory needed per parallel job, in MiB.
+ *
+ * The automatic job count never exceeds available memory divided by this value.
+ * Defaults to 1024; settable via "--mem-per-job MiB".
+ */
+extern unsigned memoryPerJobMiB;
+
+/**
+ * @brief Whether create-starpack acts as a GNU make jobserver for build scripts.
+ *
+ * Set by "--jobserver" (private token pool) or "--jobserver=PATH" (a named FIFO
+ * shared with other create-starpack instances using the same PATH). Ignored when
+ * a jobserver is already inherited through MAKEFLAGS; that one is joined instead.
+ */
+extern bool useJobserver;
+
+/**
+ * @brief Path of the shared jobserver FIFO given with "--jobserver=PATH", or empty.
+ */
+extern std::string jobserverFifo;
+
+/**
+ * @brief Output file for a Chrome trace event timeline of the build ("--trace FILE").
+ *
+ * Empty disables tracing. The file opens in chrome://tracing or ui.perfetto.dev.
+ */
+extern std::string traceFile;
+
+/**
+ * @brief Whether build phase output is shown on the terminal while it is logged.
+ *
+ * Phase stdout/stderr is always captured into logs/<package>-<version>-<phase>.log.zst
+ * next to the STARBUILD. "--no-tee" keeps it off the terminal.
+ */
+extern bool teePhaseOutput;
+
+/**
+ * @brief Number of trailing output lines printed when a phase fails ("--log-tail N").
+ */
+extern unsigned logTailLines;
+
+/**
+ * @brief Whether each build phase runs in its own transient cgroup v2 leaf.
+ *
+ * Enabled by "--cgroup" or by any of the limit flags below. Needs a delegated
+ * cgroup (e.g. "systemd-run --user --scope -p Delegate=yes create-starpack ...").
+ */
+extern bool useCgroups;
+
+/**
+ * @brief Per-phase cgroup limits, written verbatim to the phase cgroup when set.
+ *
+ * "--memory-max=8G", "--memory-high=6G", "--cpu-max=4" (CPUs, or cpu.max syntax
+ * such as "400000 100000") and "--pids-max=4096".
+ */
+extern std::string cgroupMemoryMax;
+extern std::string cgroupMemoryHigh;
+extern std::string cgroupCpuMax;
+extern std::string cgroupPidsMax;
+
+/**
+ * @brief Default wall-clock limit for each build phase in seconds, 0 for none.
+ *
+ * Set by "--phase-timeout 6h"; a STARBUILD can override it with timeout="..." or
+ * timeout_<phase>="...". Phases over the limit have their process tree dumped and
+ * their process group killed.
+ */
+extern unsigned phaseTimeoutSeconds;
+
+/**
+ * @brief Hang watchdog: seconds without CPU progress or output before a phase is
+ *        killed, 0 to disable ("--hang-timeout 30m", STARBUILD hang_timeout="...").
+ */
+extern unsigned hangTimeoutSeconds;
+
+/**
+ * @brief Whether build phases compile through ccache (C/C++) and sccache (Rust).
+ *
+ * Enabled by "--ccache" (or --ccache-dir= / --ccache-size=). Each package gets its
+ * own cache below compilerCacheDir, bounded by compilerCacheSize. A STARBUILD can
+ * opt out with compiler_cache="no".
+ */
+extern bool useCompilerCache;
+
+/**
+ * @brief Root directory of the compiler caches ("--ccache-dir=DIR"), or empty for
+ *        the default under $XDG_CACHE_HOME or ~/.cache.
+ */
+extern std::string compilerCacheDir;
+
+/**
+ * @brief Maximum size of each package's compiler cache ("--ccache-size=5G").
+ */
+extern std::string compilerCacheSize;
+
+/**
+ * @brief Whether sources are extracted and built in memory ("--tmpfs-build").
+ *
+ * The build tree, including packages/, goes on a private tmpfs (as root) or below
+ * /dev/shm when the estimated peak usage fits into memory, and on disk otherwise.
+ */
+extern bool tmpfsBuild;
+
+/**
+ * @brief YAML file with the build profiles ("--config=FILE", default
+ *        /etc/create-starpack.conf). A missing file leaves the built-in profiles.
+ */
+extern std::string buildConfigFile;
+
+/**
+ * @brief Build profile to use regardless of the STARBUILD's build_profile
+ *        ("--build-profile=NAME"), or empty.
+ */
+extern std::string buildProfileName;
+
+/**
+ * @brief Compression for man and info pages forced on the command line
+ *        ("--man-compression=gzip|xz|zstd|bzip2|none"), or empty to use the
+ *        STARBUILD's man_compression (default gzip).
+ */
+extern std::string manCompression;
+
+/**
+ * @brief Whether debug information is moved into a separate "<pkg>-debug" package
+ *        instead of being stripped ("--split-debug").
+ *
+ * Debug files go to /usr/lib/debug/.build-id/xx/yyyy.debug and the stripped
+ * objects get a .gnu_debuglink to them.
+ */
+extern bool splitDebug;
+
+/**
+ * @brief Compression for the split debug sections ("--split-debug=zstd" or
+ *        "=zlib"); empty leaves them uncompressed.
+ */
+extern std::string debugCompression;
+
 /**
  * @brief Creates a starpack package from a given STARBUILD file.
  *
@@ -111,6 +266,18 @@ bool parse_starbuild(const std::string &filepath,
 // Inline Logging Functions
 // ---------------------------------------------------------------------------
 
+/**
+ * @brief Returns the mutex that serializes console logging.
+ *
+ * Sources are extracted on worker threads, so log lines are written under this
+ * lock to keep them from interleaving mid-line.
+ */
+inline std::mutex &log_mutex()
+{
+    static std::mutex m;
+    return m;
+}
+
 /**
  * @brief Logs an informational message in green color to stderr, prefixed with "[INFO]".
  *
@@ -118,6 +285,7 @@ bool parse_starbuild(const std::string &filepath,
  */
 inline void log_message(const std::string &message)
 {
+    std::lock_guard<std::mutex> lock(log_mutex());
     std::cerr << COLOR_INFO << "[INFO] " << COLOR_RESET << message << std::endl;
 }
 
@@ -128,6 +296,7 @@ inline void log_message(const std::string &message)
  */
 inline void log_warning(const std::string &message)
 {
+    std::lock_guard<std::mutex> lock(log_mutex());
     std::cerr << COLOR_WARN << "[WARN] " << COLOR_RESET << message << std::endl;
 }
 
@@ -138,6 +307,7 @@ inline void log_warning(const std::string &message)
  */
 inline void log_error(const std::string &message)
 {
+    std::lock_guard<std::mutex> lock(log_mutex());
     std::cerr << COLOR_ERROR << "[ERROR] " << COLOR_RESET << message << std::endl;
 }
 
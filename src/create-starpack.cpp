@@ -15,11 +15,43 @@
 #include <utility>
 #include <string.h>
 #include <yaml-cpp/yaml.h>
+#include <openssl/evp.h>
 #include <unordered_set>
 #include <unordered_map>
+#include <map>
+#include <set>
 #include <git2.h>
 #include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <algorithm>
+#include <memory>
 #include <unistd.h>
+#include <fnmatch.h>
+#include <glob.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/file.h>
+#include <cmath>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <functional>
+#include <poll.h>
+#include <zstd.h>
+#include <atomic>
+#include <sys/mount.h>
+#include <sys/statvfs.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <elf.h>
+#include <dirent.h>
 
 /**
  * @brief Trims leading and trailing whitespace from the given string.
@@ -89,12 +121,316 @@ namespace Starpack
          */
         bool noStripping = false;
 
+        /**
+         * @brief Keep byte-identical files as separate copies instead of hard-linking them (--no-dedup).
+         */
+        bool noDedup = false;
+
         /**
          * @brief Global flag controlling whether to run commands under fakeroot.
          *        Defaults to true if geteuid() != 0. Overridable via --no-fakeroot.
          */
         bool useFakeroot = (geteuid() != 0);
 
+        /**
+         * @brief Parallel job count requested with --jobs; 0 means detect automatically.
+         */
+        unsigned jobsOverride = 0;
+
+        /**
+         * @brief Memory budget per parallel job (MiB) used when sizing the job count.
+         *        Settable with --mem-per-job.
+         */
+        unsigned memoryPerJobMiB = 1024;
+
+        /**
+         * @brief Whether to run a GNU make jobserver for build scripts (--jobserver).
+         */
+        bool useJobserver = false;
+
+        /**
+         * @brief Named FIFO shared by concurrent builds as one jobserver pool
+         *        (--jobserver=PATH). Empty means a private pool.
+         */
+        std::string jobserverFifo;
+
+        /**
+         * @brief Whether captured phase output is also shown live (--no-tee turns it off).
+         */
+        bool teePhaseOutput = true;
+
+        /**
+         * @brief Default wall-clock limit per phase in seconds (--phase-timeout), 0 = none.
+         *        STARBUILD "timeout" / "timeout_<phase>" override it.
+         */
+        unsigned phaseTimeoutSeconds = 0;
+
+        /**
+         * @brief Kill a phase that neither used CPU nor printed anything for this many
+         *        seconds (--hang-timeout), 0 = never. STARBUILD "hang_timeout" overrides it.
+         */
+        unsigned hangTimeoutSeconds = 0;
+
+        /**
+         * @brief Route compilers through ccache (C/C++) and sccache (Rust) (--ccache).
+         */
+        bool useCompilerCache = false;
+
+        /**
+         * @brief Root of the per-package compiler caches (--ccache-dir); empty means
+         *        $XDG_CACHE_HOME/create-starpack or ~/.cache/create-starpack.
+         */
+        std::string compilerCacheDir;
+
+        /**
+         * @brief Size budget of each package's cache (--ccache-size), in ccache/sccache syntax.
+         */
+        std::string compilerCacheSize = "5G";
+
+        /**
+         * @brief Extract and build in memory instead of the STARBUILD directory (--tmpfs-build).
+         */
+        bool tmpfsBuild = false;
+
+        /**
+         * @brief YAML file defining build profiles (--config=FILE).
+         */
+        std::string buildConfigFile = "/etc/create-starpack.conf";
+
+        /**
+         * @brief Build profile forced on the command line (--build-profile=NAME); empty
+         *        leaves the choice to the STARBUILD and the configuration file.
+         */
+        std::string buildProfileName;
+
+        /**
+         * @brief Man/info page compression forced on the command line
+         *        (--man-compression=FORMAT); empty leaves it to the STARBUILD (default gzip).
+         */
+        std::string manCompression;
+
+        /**
+         * @brief Split debug information into <pkg>-debug packages (--split-debug).
+         */
+        bool splitDebug = false;
+
+        /**
+         * @brief Compression of split debug sections ("zstd", "zlib"), empty for none.
+         */
+        std::string debugCompression;
+
+        /**
+         * @brief Run each build phase in its own cgroup v2 leaf (--cgroup or any limit flag).
+         */
+        bool useCgroups = false;
+
+        /**
+         * @brief Limits written to each phase cgroup (empty = unset): memory.max,
+         *        memory.high, cpu.max ("quota period" or a CPU count) and pids.max.
+         */
+        std::string cgroupMemoryMax;
+        std::string cgroupMemoryHigh;
+        std::string cgroupCpuMax;
+        std::string cgroupPidsMax;
+
+        /**
+         * @brief Lines of phase output kept in memory and printed when a phase fails.
+         */
+        unsigned logTailLines = 50;
+
+        /**
+         * @brief Where to write a Chrome trace of the build (--trace FILE), or empty.
+         */
+        std::string traceFile;
+
+        /**
+         * @brief Escapes a string for use inside a JSON string literal.
+         */
+        static std::string jsonEscape(const std::string &in)
+        {
+            std::string out;
+            out.reserve(in.size());
+            for (unsigned char c : in)
+            {
+                switch (c)
+                {
+                case '"':
+                    out += "\\\"";
+                    break;
+                case '\\':
+                    out += "\\\\";
+                    break;
+                case '\n':
+                    out += "\\n";
+                    break;
+                case '\t':
+                    out += "\\t";
+                    break;
+                default:
+                    if (c < 0x20)
+                    {
+                        char buf[8];
+                        std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                        out += buf;
+                    }
+                    else
+                        out += static_cast<char>(c);
+                }
+            }
+            return out;
+        }
+
+        /**
+         * @class Tracer
+         * @brief Collects timed spans of the build pipeline and writes them in Chrome
+         *        trace event format (chrome://tracing, ui.perfetto.dev).
+         *
+         * Disabled unless --trace is given; a disabled TraceSpan costs one relaxed
+         * atomic load and reads no clock.
+         */
+        class Tracer
+        {
+        public:
+            bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+            void enable()
+            {
+                origin_ = std::chrono::steady_clock::now();
+                enabled_.store(true, std::memory_order_relaxed);
+                nameThread("main");
+            }
+
+            /**
+             * @brief Microseconds since enable().
+             */
+            uint64_t now() const
+            {
+                return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                                                 std::chrono::steady_clock::now() - origin_)
+                                                 .count());
+            }
+
+            void complete(const char *category, const char *name, uint64_t start, uint64_t duration,
+                          std::string args)
+            {
+                int tid = threadId();
+                std::lock_guard<std::mutex> lock(mutex_);
+                events_.push_back({category, name, start, duration, tid, std::move(args)});
+            }
+
+            /**
+             * @brief Labels the calling thread in the trace.
+             */
+            void nameThread(const char *name)
+            {
+                if (!enabled())
+                    return;
+                int tid = threadId();
+                std::lock_guard<std::mutex> lock(mutex_);
+                threadNames_.push_back({tid, name});
+            }
+
+            bool write(const fs::path &path)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                std::ofstream out(path, std::ios::binary | std::ios::trunc);
+                int pid = static_cast<int>(::getpid());
+                out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+                    << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+                    << ",\"tid\":0,\"args\":{\"name\":\"create-starpack\"}}";
+                for (const auto &t : threadNames_)
+                {
+                    out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+                        << ",\"tid\":" << t.first << ",\"args\":{\"name\":\"" << jsonEscape(t.second) << "\"}}";
+                }
+                for (const auto &e : events_)
+                {
+                    out << ",\n{\"name\":\"" << e.name << "\",\"cat\":\"" << e.category
+                        << "\",\"ph\":\"X\",\"ts\":" << e.start << ",\"dur\":" << e.duration
+                        << ",\"pid\":" << pid << ",\"tid\":" << e.tid
+                        << ",\"args\":{" << e.args << "}}";
+                }
+                out << "\n]}\n";
+                if (!out)
+                {
+                    log_warning("Could not write trace " + path.string());
+                    return false;
+                }
+                log_message("Wrote trace with " + std::to_string(events_.size()) + " spans to " + path.string());
+                return true;
+            }
+
+        private:
+            struct Event
+            {
+                const char *category;
+                const char *name;
+                uint64_t start;
+                uint64_t duration;
+                int tid;
+                std::string args;
+            };
+
+            static int threadId()
+            {
+                static std::atomic<int> next{1};
+                thread_local int id = next.fetch_add(1);
+                return id;
+            }
+
+            std::atomic<bool> enabled_{false};
+            std::chrono::steady_clock::time_point origin_;
+            std::mutex mutex_;
+            std::vector<Event> events_;
+            std::vector<std::pair<int, std::string>> threadNames_;
+        };
+
+        static Tracer tracer;
+
+        /**
+         * @class TraceSpan
+         * @brief Scoped span: records the time between construction and destruction.
+         *        Names and categories must be string literals.
+         */
+        class TraceSpan
+        {
+        public:
+            TraceSpan(const char *category, const char *name)
+                : category_(category), name_(name), active_(tracer.enabled())
+            {
+                if (active_)
+                    start_ = tracer.now();
+            }
+
+            ~TraceSpan()
+            {
+                if (active_)
+                    tracer.complete(category_, name_, start_, tracer.now() - start_, std::move(args_));
+            }
+
+            TraceSpan(const TraceSpan &) = delete;
+            TraceSpan &operator=(const TraceSpan &) = delete;
+
+            /**
+             * @brief Attaches a key/value shown in the span's details.
+             */
+            void arg(const char *key, const std::string &value)
+            {
+                if (!active_)
+                    return;
+                if (!args_.empty())
+                    args_ += ",";
+                args_ += "\"" + std::string(key) + "\":\"" + jsonEscape(value) + "\"";
+            }
+
+        private:
+            const char *category_;
+            const char *name_;
+            bool active_;
+            uint64_t start_ = 0;
+            std::string args_;
+        };
+
         std::vector<std::string> clashes;
         std::vector<std::string> gives;
         std::vector<std::string> optional_dependencies;
@@ -138,6 +474,246 @@ namespace Starpack
                 fs::remove(resumeFile);
         }
 
+        /**
+         * @struct ExtractOptions
+         * Per-archive extraction settings from the STARBUILD "extract_options" array,
+         * e.g. "linux-firmware.tar.xz::include=amdgpu;exclude=*.txt;strip=1;dest=fw".
+         *
+         * Entries are first shortened by stripComponents leading path components, then
+         * matched against the include/exclude globs, and finally placed below destSubdir.
+         * Entries that are filtered out are skipped while reading the archive headers.
+         */
+        struct ExtractOptions
+        {
+            std::vector<std::string> include;
+            std::vector<std::string> exclude;
+            int stripComponents = 0;
+            std::string destSubdir;
+
+            bool empty() const
+            {
+                return include.empty() && exclude.empty() && stripComponents == 0 && destSubdir.empty();
+            }
+
+            /**
+             * @brief Canonical text form, stored in the extraction stamp so that changing
+             *        the options causes the archive to be extracted again.
+             */
+            std::string describe() const
+            {
+                std::string out;
+                for (const auto &g : include)
+                    out += "include=" + g + ";";
+                for (const auto &g : exclude)
+                    out += "exclude=" + g + ";";
+                if (stripComponents > 0)
+                    out += "strip=" + std::to_string(stripComponents) + ";";
+                if (!destSubdir.empty())
+                    out += "dest=" + destSubdir + ";";
+                return out;
+            }
+
+            /**
+             * @brief Maps a normalized entry path to its output path.
+             *
+             * A glob matches a path if it matches the whole (stripped) path or one of its
+             * leading directories, so "include=docs" selects everything below docs/.
+             * Globs without a slash are also tried against the file name alone.
+             *
+             * @return False if the entry is filtered out.
+             */
+            bool map(std::string &rel) const
+            {
+                if (!strip(rel))
+                    return false;
+                if (!include.empty() && !matchesAny(include, rel))
+                    return false;
+                if (matchesAny(exclude, rel))
+                    return false;
+                if (!destSubdir.empty())
+                    rel = destSubdir + "/" + rel;
+                return true;
+            }
+
+        private:
+            bool strip(std::string &rel) const
+            {
+                for (int i = 0; i < stripComponents; ++i)
+                {
+                    size_t slash = rel.find('/');
+                    if (slash == std::string::npos)
+                        return false;
+                    rel.erase(0, slash + 1);
+                }
+                return !rel.empty();
+            }
+
+            static bool matchesAny(const std::vector<std::string> &globs, const std::string &rel)
+            {
+                std::string_view base(rel);
+                size_t slash = rel.rfind('/');
+                if (slash != std::string::npos)
+                    base = base.substr(slash + 1);
+
+                for (const auto &glob : globs)
+                {
+                    if (glob.find('/') == std::string::npos &&
+                        fnmatch(glob.c_str(), std::string(base).c_str(), 0) == 0)
+                        return true;
+
+                    for (size_t end = rel.find('/'); ; end = rel.find('/', end + 1))
+                    {
+                        std::string prefix = rel.substr(0, end);
+                        if (fnmatch(glob.c_str(), prefix.c_str(), 0) == 0)
+                            return true;
+                        if (end == std::string::npos)
+                            break;
+                    }
+                }
+                return false;
+            }
+        };
+
+        /**
+         * @brief Parses one "extract_options" element ("<archive>::key=value;...").
+         *
+         * Recognized keys are include, exclude (both repeatable, values may also be
+         * comma-separated), strip and dest.
+         *
+         * @return False if the element is malformed.
+         */
+        static bool parseExtractOptions(const std::string &spec, std::string &archiveName, ExtractOptions &opts)
+        {
+            size_t sep = spec.find("::");
+            if (sep == std::string::npos)
+                return false;
+            archiveName = trim(spec.substr(0, sep));
+            if (archiveName.empty())
+                return false;
+
+            std::stringstream ss(spec.substr(sep + 2));
+            std::string item;
+            while (std::getline(ss, item, ';'))
+            {
+                item = trim(item);
+                if (item.empty())
+                    continue;
+                size_t eq = item.find('=');
+                if (eq == std::string::npos)
+                    return false;
+                std::string key = trim(item.substr(0, eq));
+                std::string value = trim(item.substr(eq + 1));
+
+                if (key == "include" || key == "exclude")
+                {
+                    std::stringstream vs(value);
+                    std::string glob;
+                    while (std::getline(vs, glob, ','))
+                    {
+                        glob = trim(glob);
+                        if (!glob.empty())
+                            (key == "include" ? opts.include : opts.exclude).push_back(glob);
+                    }
+                }
+                else if (key == "strip")
+                {
+                    try
+                    {
+                        opts.stripComponents = std::stoi(value);
+                    }
+                    catch (const std::exception &)
+                    {
+                        return false;
+                    }
+                    if (opts.stripComponents < 0)
+                        return false;
+                }
+                else if (key == "dest")
+                {
+                    while (!value.empty() && value.back() == '/')
+                        value.pop_back();
+                    if (value.empty() || value.front() == '/' || value.find("..") != std::string::npos)
+                        return false;
+                    opts.destSubdir = value;
+                }
+                else
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        /**
+         * @brief Parses a duration such as "90", "90s", "45m", "6h" or "1h30m" into seconds.
+         */
+        static bool parseDuration(const std::string &text, unsigned &seconds)
+        {
+            unsigned long total = 0;
+            size_t i = 0;
+            if (text.empty())
+                return false;
+            while (i < text.size())
+            {
+                size_t digits = i;
+                while (i < text.size() && std::isdigit(static_cast<unsigned char>(text[i])))
+                    ++i;
+                if (digits == i)
+                    return false;
+                unsigned long value = std::stoul(text.substr(digits, i - digits));
+                char unit = i < text.size() ? text[i++] : 's';
+                switch (unit)
+                {
+                case 's':
+                    total += value;
+                    break;
+                case 'm':
+                    total += value * 60;
+                    break;
+                case 'h':
+                    total += value * 3600;
+                    break;
+                default:
+                    return false;
+                }
+            }
+            seconds = static_cast<unsigned>(total);
+            return true;
+        }
+
+        /**
+         * @brief Single-value STARBUILD settings that tune the build rather than describe
+         *        the package, stored in recipeOptions by parse_starbuild().
+         */
+        static bool isRecipeOption(const std::string &key)
+        {
+            static const std::unordered_set<std::string> keys = {
+                "timeout", "timeout_prepare", "timeout_compile", "timeout_verify", "timeout_assemble",
+                "timeout_train", "hang_timeout", "compiler_cache", "pgo", "build_profile", "man_compression"};
+            return keys.count(key) != 0;
+        }
+
+        /**
+         * @brief Reads a yes/no recipe option such as compiler_cache="no" or pgo="true".
+         */
+        static bool recipeFlag(const std::unordered_map<std::string, std::string> &recipeOptions,
+                               const std::string &key, bool fallback)
+        {
+            auto it = recipeOptions.find(key);
+            if (it == recipeOptions.end())
+                return fallback;
+            std::string value = it->second;
+            std::transform(value.begin(), value.end(), value.begin(),
+                           [](unsigned char c)
+                           { return static_cast<char>(std::tolower(c)); });
+            if (value == "true" || value == "yes" || value == "on" || value == "1")
+                return true;
+            if (value == "false" || value == "no" || value == "off" || value == "0")
+                return false;
+            log_warning("Ignoring invalid " + key + "=\"" + it->second + "\" in STARBUILD.");
+            return fallback;
+        }
+
         //------------------------------------------------------------------------------
         // parse_starbuild
         //------------------------------------------------------------------------------
@@ -145,6 +721,8 @@ namespace Starpack
         // function bodies (prepare, compile, verify, assemble), and arrays like dependencies.
         //
         // If you have subpackage "dependencies_foo", it stores them in subpackageDependencies["foo"].
+        // Per-archive "extract_options" entries are stored in extractOptions, keyed by file name.
+        // Build settings such as timeout_compile="6h" (see isRecipeOption()) go to recipeOptions.
         //
         // This function also populates a list of symlink pairs if lines are encountered with
         // "symlink: \"link:target\"" syntax.
@@ -168,7 +746,9 @@ namespace Starpack
             std::string &generic_assemble_function,
             std::unordered_map<std::string, std::string> &assemble_functions,
             std::vector<std::pair<std::string, std::string>> &symlinkPairs,
-            std::vector<std::string> &customFunctions)
+            std::vector<std::string> &customFunctions,
+            std::unordered_map<std::string, ExtractOptions> &extractOptions,
+            std::unordered_map<std::string, std::string> &recipeOptions)
 
         {
             std::ifstream file(filepath);
@@ -189,6 +769,7 @@ namespace Starpack
             std::regex re_gives("^gives\\s*=\\s*\\((.*)\\)");
             std::regex re_optional_dependencies("^optional_dependencies\\s*=\\s*\\((.*)\\)");
             std::regex re_any_func(R"(^([_A-Za-z]\w*)\s*\(\)\s*\{)");
+            std::regex re_recipe_option(R"re(^([_A-Za-z]\w*)\s*=\s*"?([^"()]*)"?$)re");
 
             static const std::unordered_set<std::string> builtinFuncs = {
                 "prepare", "compile", "verify", "assemble"};
@@ -331,6 +912,13 @@ namespace Starpack
                     continue;
                 }
 
+                // build settings, e.g. timeout_compile="6h"
+                if (std::regex_match(trimmed, match, re_recipe_option) && isRecipeOption(match[1].str()))
+                {
+                    recipeOptions[match[1].str()] = trim(match[2].str());
+                    continue;
+                }
+
                 // description="..."
                 if (std::regex_match(trimmed, match, re_description))
                 {
@@ -400,24 +988,57 @@ namespace Starpack
                     continue;
                 }
 
-                // 7) parse symlink: lines with "symlink: "link:target""
-                if (trimmed.rfind("symlink:", 0) == 0)
+                // 6b) parse extract_options = ( "file.tar.xz::include=a/*;strip=1" ), possibly multiline
+                if (trimmed.rfind("extract_options=", 0) == 0)
                 {
-                    std::string pairStr = trim(trimmed.substr(8));
-                    if (!pairStr.empty() && pairStr.front() == '\"' && pairStr.back() == '\"')
-                    {
-                        pairStr = pairStr.substr(1, pairStr.size() - 2);
-                    }
-                    size_t colonPos = pairStr.find(':');
-                    if (colonPos != std::string::npos)
+                    size_t startPos = trimmed.find("(");
+                    if (startPos != std::string::npos)
                     {
-                        std::string link = trim(pairStr.substr(0, colonPos));
-                        std::string target = trim(pairStr.substr(colonPos + 1));
-                        if (!link.empty() && !target.empty())
+                        std::string arr = trimmed.substr(startPos + 1);
+                        while (arr.find(")") == std::string::npos)
                         {
-                            symlinkPairs.push_back({link, target});
+                            if (!std::getline(file, line))
+                                break;
+                            arr += " " + trim(line);
                         }
-                    }
+                        size_t endPos = arr.find(")");
+                        if (endPos != std::string::npos)
+                        {
+                            arr = arr.substr(0, endPos);
+                        }
+                        for (const auto &spec : extract_quoted_strings(arr))
+                        {
+                            std::string archiveName;
+                            ExtractOptions opts;
+                            if (!parseExtractOptions(spec, archiveName, opts))
+                            {
+                                log_error("Invalid extract_options entry: " + spec);
+                                return false;
+                            }
+                            extractOptions[archiveName] = opts;
+                        }
+                    }
+                    continue;
+                }
+
+                // 7) parse symlink: lines with "symlink: "link:target""
+                if (trimmed.rfind("symlink:", 0) == 0)
+                {
+                    std::string pairStr = trim(trimmed.substr(8));
+                    if (!pairStr.empty() && pairStr.front() == '\"' && pairStr.back() == '\"')
+                    {
+                        pairStr = pairStr.substr(1, pairStr.size() - 2);
+                    }
+                    size_t colonPos = pairStr.find(':');
+                    if (colonPos != std::string::npos)
+                    {
+                        std::string link = trim(pairStr.substr(0, colonPos));
+                        std::string target = trim(pairStr.substr(colonPos + 1));
+                        if (!link.empty() && !target.empty())
+                        {
+                            symlinkPairs.push_back({link, target});
+                        }
+                    }
                     continue;
                 }
 
@@ -614,6 +1235,8 @@ namespace Starpack
          */
         bool downloadFile(const std::string &url, const std::string &destPath)
         {
+            TraceSpan span("fetch", "download");
+            span.arg("url", url);
             using namespace std::filesystem;
             uintmax_t existingSize = 0;
             bool resume = false;
@@ -694,7 +1317,7 @@ namespace Starpack
         /**
          * @brief Determines if a file is recognized as an archive by libmagic.
          *
-         * Checks for tar, gzip, bzip2, xz, lzip, or zip MIME types.
+         * Checks for tar, gzip, bzip2, xz, lzip, zstd, lz4, or zip MIME types.
          *
          * @param filePath The path to the file to examine.
          * @return True if recognized as an archive format, false otherwise.
@@ -715,6 +1338,8 @@ namespace Starpack
                                           strstr(fileType, "bzip2") ||
                                           strstr(fileType, "xz") ||
                                           strstr(fileType, "lzip") ||
+                                          strstr(fileType, "zstd") ||
+                                          strstr(fileType, "lz4") ||
                                           strstr(fileType, "zip"));
 
             magic_close(magic);
@@ -722,591 +1347,6087 @@ namespace Starpack
         }
 
         /**
-         * @brief Extracts a recognized archive into the current directory using libarchive.
-         *        Skips extraction if "NOEXTRACT" is in the file name.
+         * @brief Looks up an executable in $PATH.
          *
-         * @param archivePath The local path to the archive file.
-         * @return True on successful extraction, false otherwise.
+         * @param name The program name (no slashes).
+         * @param skipDir A $PATH directory to ignore, e.g. one holding wrappers of name.
+         * @return The full path, or an empty string if it is not installed.
          */
-        bool extractArchive(const std::string &archivePath)
+        static std::string findInPath(const std::string &name, const fs::path &skipDir = {})
         {
-            // 1) If it doesn’t look like an archive, skip.
-            if (!isArchiveFile(archivePath))
+            const char *pathEnv = getenv("PATH");
+            std::string pathList = pathEnv ? pathEnv : "/usr/local/bin:/usr/bin:/bin";
+            size_t pos = 0;
+            while (pos <= pathList.size())
             {
-                log_message("Not an archive, skipping extraction: " + archivePath);
+                size_t next = pathList.find(':', pos);
+                if (next == std::string::npos)
+                    next = pathList.size();
+                std::string dir = pathList.substr(pos, next - pos);
+                if (!dir.empty() &&
+                    (skipDir.empty() || fs::path(dir).lexically_normal() != skipDir.lexically_normal()))
+                {
+                    std::string candidate = dir + "/" + name;
+                    if (::access(candidate.c_str(), X_OK) == 0)
+                        return candidate;
+                }
+                pos = next + 1;
+            }
+            return "";
+        }
+
+        /**
+         * @class BoundedQueue
+         * @brief Blocking producer/consumer queue limited by the total "cost" of queued items.
+         *
+         * push() blocks while the queue is over capacity, pop() blocks while it is empty.
+         * close() lets the consumer drain what is left; abort() also makes pending and
+         * future push() calls fail so the producer can stop early.
+         */
+        template <typename T>
+        class BoundedQueue
+        {
+        public:
+            explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+            bool push(T item, size_t cost)
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                notFull_.wait(lock, [&]
+                              { return aborted_ || used_ == 0 || used_ + cost <= capacity_; });
+                if (aborted_)
+                    return false;
+                items_.push_back({std::move(item), cost});
+                used_ += cost;
+                notEmpty_.notify_one();
                 return true;
             }
 
-            // 2) NOEXTRACT override
-            if (archivePath.find("NOEXTRACT") != std::string::npos)
+            bool pop(T &item)
             {
-                log_message("NOEXTRACT flag found; skipping extraction: " + archivePath);
+                std::unique_lock<std::mutex> lock(mutex_);
+                notEmpty_.wait(lock, [&]
+                               { return closed_ || aborted_ || !items_.empty(); });
+                if (items_.empty() || aborted_)
+                    return false;
+                item = std::move(items_.front().first);
+                used_ -= items_.front().second;
+                items_.pop_front();
+                notFull_.notify_one();
                 return true;
             }
 
-            // 3) Compute the expected output directory, e.g. "./foo-1.2.3" for "foo-1.2.3.tar.xz"
-            std::string filename = std::filesystem::path(archivePath).filename().string();
-            static const std::vector<std::string> exts = {
-                ".tar.xz", ".tar.gz", ".tgz", ".tar.bz2", ".tbz2", ".zip"};
-            std::string base = filename;
-            for (auto &ext : exts)
+            void close()
             {
-                if (base.size() > ext.size() && base.substr(base.size() - ext.size()) == ext)
-                {
-                    base.erase(base.size() - ext.size());
-                    break;
-                }
+                std::lock_guard<std::mutex> lock(mutex_);
+                closed_ = true;
+                notEmpty_.notify_all();
             }
-            fs::path destDir = fs::path("./") / base;
 
-            // 4) If destDir exists and isn’t empty, assume already extracted
-            std::error_code ec;
-            if (fs::exists(destDir, ec) && fs::is_directory(destDir, ec))
+            void abort()
             {
-                bool hasContent = false;
-                for (auto &p : fs::directory_iterator(destDir, fs::directory_options::skip_permission_denied, ec))
-                {
-                    hasContent = true;
-                    break;
-                }
-                if (!ec && hasContent)
+                std::lock_guard<std::mutex> lock(mutex_);
+                aborted_ = true;
+                notEmpty_.notify_all();
+                notFull_.notify_all();
+            }
+
+        private:
+            size_t capacity_;
+            size_t used_ = 0;
+            std::deque<std::pair<T, size_t>> items_;
+            std::mutex mutex_;
+            std::condition_variable notEmpty_;
+            std::condition_variable notFull_;
+            bool closed_ = false;
+            bool aborted_ = false;
+        };
+
+        /**
+         * @brief Read block size handed to libarchive when extracting sources.
+         *
+         * Large blocks keep the number of read() calls on big tarballs low.
+         */
+        static constexpr size_t kExtractReadBlockSize = 1024 * 1024;
+
+        /**
+         * @brief Upper bound on decoded data buffered between the decoder thread and
+         *        the writer in extractArchive().
+         */
+        static constexpr size_t kExtractQueueBytes = 64 * 1024 * 1024;
+
+        /**
+         * @class ExtractionWriter
+         * @brief Writes archive entries below a root directory using *at() syscalls.
+         *
+         * Entries are created relative to a descriptor for their parent directory, so
+         * creating an entry costs one openat()/mkdirat()/symlinkat()/linkat() instead of
+         * a series of std::filesystem calls. Parent directories are opened one component
+         * at a time with O_NOFOLLOW, so a symlink written by an earlier entry can never
+         * redirect later entries outside the root; the last parent is kept open for the
+         * siblings that follow it. Regular files are preallocated when the archive records their
+         * size (sparse members are sized with ftruncate() instead, and only their data
+         * regions are written), and directory permissions/mtimes are applied in one
+         * batch by finish()
+         * (after all children have been written, which also keeps read-only
+         * directories writable during extraction).
+         */
+        class ExtractionWriter
+        {
+        public:
+            explicit ExtractionWriter(const fs::path &root)
+            {
+                std::error_code ec;
+                fs::create_directories(root, ec);
+                rootFd_ = ::open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (rootFd_ < 0)
                 {
-                    log_message("Archive already extracted, skipping: " + archivePath);
-                    return true;
+                    log_error("Could not open extraction directory " + root.string() + ": " + strerror(errno));
                 }
             }
 
-            // 5) Otherwise, proceed to extract
-            log_message("Extracting archive: " + archivePath);
+            ~ExtractionWriter()
+            {
+                if (fileFd_ >= 0)
+                    ::close(fileFd_);
+                if (parentFd_ >= 0)
+                    ::close(parentFd_);
+                if (rootFd_ >= 0)
+                    ::close(rootFd_);
+            }
 
-            struct archive *a = archive_read_new();
-            archive_read_support_format_zip(a);
-            archive_read_support_format_tar(a);
-            archive_read_support_filter_gzip(a);
-            archive_read_support_filter_bzip2(a);
-            archive_read_support_filter_xz(a);
-            archive_read_support_filter_lzip(a);
+            ExtractionWriter(const ExtractionWriter &) = delete;
+            ExtractionWriter &operator=(const ExtractionWriter &) = delete;
 
-            if (archive_read_open_filename(a, archivePath.c_str(), 10240) != ARCHIVE_OK)
+            bool ok() const { return rootFd_ >= 0; }
+
+            /**
+             * @brief Starts writing an entry. Directories and symlinks are complete after
+             *        this call; regular files are opened and wait for writeData().
+             *
+             * @param rel The entry path as returned by relativeEntryPath().
+             * @return False on a fatal error, which has already been logged.
+             */
+            bool beginEntry(const std::string &rel, struct archive_entry *entry)
             {
-                log_error("Failed to open archive: " + archivePath + " => " + archive_error_string(a));
-                archive_read_free(a);
-                return false;
+                if (rel.empty())
+                    return true; // "./" itself
+
+                std::string leaf;
+                int dirFd = parentDirectory(rel, leaf);
+                if (dirFd < 0)
+                    return false;
+
+                if (archive_entry_hardlink(entry))
+                    return writeHardlink(dirFd, leaf, rel, entry);
+
+                switch (archive_entry_filetype(entry))
+                {
+                case AE_IFDIR:
+                    return writeDirectory(dirFd, leaf, rel, entry);
+                case AE_IFLNK:
+                    return writeSymlink(dirFd, leaf, rel, entry);
+                default:
+                    return openFile(dirFd, leaf, rel, entry);
+                }
             }
 
-            struct archive_entry *entry;
-            while (archive_read_next_header(a, &entry) == ARCHIVE_OK)
+            /**
+             * @brief Writes a block of file data at the given offset of the open entry.
+             */
+            bool writeData(const void *data, size_t size, int64_t offset)
             {
-                const char *currentFile = archive_entry_pathname(entry);
-                fs::path fullOutputPath = fs::path("./") / currentFile;
+                if (fileFd_ < 0)
+                    return true;
+                if (!writeAll(fileFd_, static_cast<const char *>(data), size, offset))
+                {
+                    log_error("Write failed for " + fileRel_ + ": " + strerror(errno));
+                    closeFile();
+                    return false;
+                }
+                return true;
+            }
 
-                // Create parent directories
-                fs::create_directories(fullOutputPath.parent_path(), ec);
+            /**
+             * @brief Finishes the current entry, applying mode and mtime to regular files.
+             */
+            bool endEntry()
+            {
+                if (fileFd_ < 0)
+                    return true;
 
-                // Handle directories, symlinks, and regular files as before…
-                if (archive_entry_filetype(entry) == AE_IFDIR)
+                ::fchmod(fileFd_, fileMode_);
+                if (fileHasMtime_)
                 {
-                    fs::create_directories(fullOutputPath, ec);
-                    fs::permissions(fullOutputPath,
-                                    static_cast<fs::perms>(archive_entry_perm(entry)),
-                                    fs::perm_options::replace, ec);
+                    struct timespec times[2] = {{0, UTIME_OMIT}, fileMtime_};
+                    ::futimens(fileFd_, times);
                 }
-                else if (archive_entry_filetype(entry) == AE_IFLNK)
+                return closeFile();
+            }
+
+            /**
+             * @brief Normalizes an entry path to a root-relative one. Rejects paths
+             *        containing "..", drops leading "/" and "." components.
+             */
+            static bool relativeEntryPath(const char *name, std::string &out)
+            {
+                out.clear();
+                if (!name)
+                    return false;
+
+                std::string_view path(name);
+                size_t pos = 0;
+                while (pos <= path.size())
                 {
-                    const char *linkTarget = archive_entry_symlink(entry);
-                    if (!linkTarget)
-                    {
-                        log_error("Symlink entry has no target: " + std::string(currentFile));
-                        archive_read_free(a);
+                    size_t next = path.find('/', pos);
+                    if (next == std::string_view::npos)
+                        next = path.size();
+                    std::string_view comp = path.substr(pos, next - pos);
+                    if (comp == "..")
                         return false;
-                    }
-                    fs::create_symlink(linkTarget, fullOutputPath, ec);
-                    if (ec)
+                    if (!comp.empty() && comp != ".")
                     {
-                        log_error("Failed to create symlink " + fullOutputPath.string() +
-                                  " -> " + linkTarget + ": " + ec.message());
-                        archive_read_free(a);
-                        return false;
+                        if (!out.empty())
+                            out += '/';
+                        out.append(comp);
                     }
+                    pos = next + 1;
                 }
-                else // regular file
+                return true;
+            }
+
+            /**
+             * @brief Applies the deferred directory metadata. The recorded paths were
+             *        opened as real directories and are never replaced afterwards (unlinkat()
+             *        without AT_REMOVEDIR refuses directories), so they resolve beneath the root.
+             */
+            bool finish()
+            {
+                for (const auto &d : deferredDirs_)
                 {
-                    std::ofstream outFile(fullOutputPath, std::ios::binary);
-                    if (!outFile.is_open())
+                    if (::fchmodat(rootFd_, d.path.c_str(), d.mode, 0) != 0)
                     {
-                        log_error("Could not open for writing: " + fullOutputPath.string());
-                        archive_read_free(a);
-                        return false;
+                        log_warning("Could not set permissions on " + d.path + ": " + strerror(errno));
                     }
-                    const void *buff;
-                    size_t size;
-                    la_int64_t offset;
-                    while (true)
+                    if (d.hasMtime)
                     {
-                        int r = archive_read_data_block(a, &buff, &size, &offset);
-                        if (r == ARCHIVE_EOF)
-                            break;
-                        if (r < ARCHIVE_OK)
-                        {
-                            log_error("archive_read_data_block: " + std::string(archive_error_string(a)));
-                            outFile.close();
-                            archive_read_free(a);
-                            return false;
-                        }
-                        outFile.write(reinterpret_cast<const char *>(buff), size);
+                        struct timespec times[2] = {{0, UTIME_OMIT}, d.mtime};
+                        ::utimensat(rootFd_, d.path.c_str(), times, 0);
                     }
-                    outFile.close();
-                    fs::permissions(fullOutputPath,
-                                    static_cast<fs::perms>(archive_entry_perm(entry)),
-                                    fs::perm_options::replace, ec);
                 }
+                deferredDirs_.clear();
+                return true;
             }
 
-            archive_read_close(a);
-            archive_read_free(a);
-            log_message("Extracted " + archivePath + " into current directory.");
-            return true;
-        }
-
-        /**
-         * @struct GitProgress
-         * Contains a single double to track the last printed progress percentage in the clone process.
-         */
-        struct GitProgress
-        {
-            double lastPercent = 0.0;
-        };
+        private:
+            struct DirMeta
+            {
+                std::string path;
+                mode_t mode;
+                bool hasMtime;
+                struct timespec mtime;
+            };
 
-        /**
-         * @brief Callback invoked by libgit2 during clone/fetch progress. Displays a combined
-         *        "receiving + indexing" progress bar.
-         */
-        static int transferProgress(const git_transfer_progress *stats, void *payload)
-        {
-            // Avoid dividing by zero if total_objects not known
-            if (stats->total_objects == 0)
+            static std::string parentOf(const std::string &rel)
             {
-                return 0;
+                size_t slash = rel.rfind('/');
+                return slash == std::string::npos ? std::string() : rel.substr(0, slash);
             }
 
-            double receivingWeight = 0.5;
-            double indexingWeight = 0.5;
-            double receiveRatio = static_cast<double>(stats->received_objects) / stats->total_objects;
-            double indexRatio = static_cast<double>(stats->indexed_objects) / stats->total_objects;
-            double overallProgress = receivingWeight * receiveRatio + indexingWeight * indexRatio;
-
-            double percent = overallProgress * 100.0;
+            /**
+             * @brief Opens the directory name inside dirFd without following a symlink.
+             *
+             * @param create mkdirat()s a missing directory, and replaces a symlink from an
+             *               earlier entry with a real directory.
+             * @return A new descriptor, or -1 with errno set.
+             */
+            static int openChildDirectory(int dirFd, const std::string &name, bool create)
+            {
+                const int flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+                int fd = ::openat(dirFd, name.c_str(), flags);
+                if (fd >= 0 || !create)
+                    return fd;
+
+                // O_DIRECTORY|O_NOFOLLOW reports a symlink as ENOTDIR or ELOOP.
+                struct stat st;
+                if (errno != ENOENT)
+                {
+                    if (::fstatat(dirFd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISLNK(st.st_mode))
+                    {
+                        errno = ENOTDIR;
+                        return -1;
+                    }
+                    ::unlinkat(dirFd, name.c_str(), 0);
+                }
+                if (::mkdirat(dirFd, name.c_str(), 0755) == 0 || errno == EEXIST)
+                    fd = ::openat(dirFd, name.c_str(), flags);
+                return fd;
+            }
 
-            GitProgress *gp = static_cast<GitProgress *>(payload);
-            if (percent - gp->lastPercent >= 1.0)
+            /**
+             * @brief Opens directory rel below the root one component at a time.
+             *
+             * @return A new descriptor, or -1 with errno set.
+             */
+            int openDirectory(const std::string &rel, bool create)
             {
-                gp->lastPercent = percent;
+                int fd = ::fcntl(rootFd_, F_DUPFD_CLOEXEC, 0);
+                size_t pos = 0;
+                while (fd >= 0 && pos < rel.size())
+                {
+                    size_t next = rel.find('/', pos);
+                    if (next == std::string::npos)
+                        next = rel.size();
+                    int child = openChildDirectory(fd, rel.substr(pos, next - pos), create);
+                    int savedErrno = errno;
+                    ::close(fd);
+                    errno = savedErrno;
+                    fd = child;
+                    pos = next + 1;
+                }
+                return fd;
+            }
 
-                int barWidth = 50;
-                int pos = static_cast<int>(overallProgress * barWidth);
+            /**
+             * @brief Returns a descriptor for the directory containing rel, creating it as
+             *        needed, and stores rel's last component in leaf. The descriptor stays
+             *        owned by the writer and is reused while entries share a parent.
+             */
+            int parentDirectory(const std::string &rel, std::string &leaf)
+            {
+                std::string parent = parentOf(rel);
+                leaf = parent.empty() ? rel : rel.substr(parent.size() + 1);
+                if (parentFd_ >= 0 && parent == parentRel_)
+                    return parentFd_;
+
+                if (parentFd_ >= 0)
+                    ::close(parentFd_);
+                parentRel_ = parent;
+                parentFd_ = openDirectory(parent, true);
+                if (parentFd_ < 0)
+                {
+                    log_error("Could not create directory " + parent + ": " + strerror(errno));
+                }
+                return parentFd_;
+            }
 
-                std::string bar(barWidth, ' ');
-                for (int i = 0; i < pos; ++i)
+            bool writeDirectory(int dirFd, const std::string &leaf, const std::string &rel,
+                                struct archive_entry *entry)
+            {
+                int fd = openChildDirectory(dirFd, leaf, true);
+                if (fd < 0)
                 {
-                    bar[i] = '#';
+                    log_error("Could not create directory " + rel + ": " + strerror(errno));
+                    return false;
                 }
 
-                fprintf(stderr, "\r[%-50s] %3.0f%%  (recv %.0f%%, idx %.0f%%)",
-                        bar.c_str(), percent, receiveRatio * 100.0, indexRatio * 100.0);
-                fflush(stderr);
+                DirMeta meta{rel, static_cast<mode_t>(archive_entry_perm(entry)), false, {}};
+                if (archive_entry_mtime_is_set(entry))
+                {
+                    meta.hasMtime = true;
+                    meta.mtime = {archive_entry_mtime(entry), archive_entry_mtime_nsec(entry)};
+                }
+                // Keep the directory writable until finish() so its children can be created.
+                ::fchmod(fd, meta.mode | S_IRWXU);
+                ::close(fd);
+                deferredDirs_.push_back(std::move(meta));
+                return true;
             }
-            return 0;
-        }
 
-        /**
-         * @brief Clones a Git repo to the specified directory, showing a progress bar via libgit2.
-         *
-         * Skips if the target directory already exists and is non-empty.
-         *
-         * @param url The remote Git repository URL.
-         * @param destDir The local directory where it will be cloned.
-         * @return True on success, false otherwise.
-         */
-        bool cloneGitRepo(const std::string &url, const std::string &destDir)
-        {
-            // If directory is non-empty, skip clone to avoid conflicts
-            if (std::filesystem::exists(destDir) && !std::filesystem::is_empty(destDir))
+            bool writeSymlink(int dirFd, const std::string &leaf, const std::string &rel,
+                              struct archive_entry *entry)
             {
-                log_message("Directory '" + destDir + "' already exists; skipping clone...");
+                const char *linkTarget = archive_entry_symlink(entry);
+                if (!linkTarget)
+                {
+                    log_error("Symlink entry has no target: " + rel);
+                    return false;
+                }
+                if (::symlinkat(linkTarget, dirFd, leaf.c_str()) != 0)
+                {
+                    if (errno != EEXIST || ::unlinkat(dirFd, leaf.c_str(), 0) != 0 ||
+                        ::symlinkat(linkTarget, dirFd, leaf.c_str()) != 0)
+                    {
+                        log_error("Failed to create symlink " + rel + " -> " + linkTarget + ": " + strerror(errno));
+                        return false;
+                    }
+                }
                 return true;
             }
 
-            // Use default clone options with a custom fetch progress callback
-            git_clone_options cloneOpts = GIT_CLONE_OPTIONS_INIT;
-            cloneOpts.fetch_opts.callbacks.transfer_progress = transferProgress;
+            /**
+             * @brief Links rel to an entry extracted earlier from the same archive, so
+             *        hardlinked files are stored once instead of as separate copies.
+             */
+            bool writeHardlink(int dirFd, const std::string &leaf, const std::string &rel,
+                               struct archive_entry *entry)
+            {
+                std::string target;
+                if (!relativeEntryPath(archive_entry_hardlink(entry), target) || target.empty())
+                {
+                    log_warning("Skipping hardlink with unsafe target: " + rel);
+                    return true;
+                }
 
-            GitProgress gp;
-            cloneOpts.fetch_opts.callbacks.payload = &gp;
+                // The target's directories must not be symlinks either, or the link could
+                // pick up (and writeData() overwrite) a file outside the root.
+                std::string targetParent = parentOf(target);
+                std::string targetLeaf = targetParent.empty() ? target : target.substr(targetParent.size() + 1);
+                int targetDirFd = openDirectory(targetParent, false);
+                if (targetDirFd < 0)
+                {
+                    log_error("Failed to create hardlink " + rel + " => " + target + ": " + strerror(errno));
+                    return false;
+                }
+                bool linked = ::linkat(targetDirFd, targetLeaf.c_str(), dirFd, leaf.c_str(), 0) == 0 ||
+                              (errno == EEXIST && ::unlinkat(dirFd, leaf.c_str(), 0) == 0 &&
+                               ::linkat(targetDirFd, targetLeaf.c_str(), dirFd, leaf.c_str(), 0) == 0);
+                int savedErrno = errno;
+                ::close(targetDirFd);
+                if (!linked)
+                {
+                    log_error("Failed to create hardlink " + rel + " => " + target + ": " + strerror(savedErrno));
+                    return false;
+                }
 
-            git_repository *repo = nullptr;
-            int error = git_clone(&repo, url.c_str(), destDir.c_str(), &cloneOpts);
+                // Some formats (pax, cpio) may still carry data for a hardlink entry;
+                // open the link so writeData() updates the shared inode.
+                if (archive_entry_size_is_set(entry) && archive_entry_size(entry) > 0)
+                    return openFile(dirFd, leaf, rel, entry);
+                return true;
+            }
 
-            fprintf(stderr, "\n"); // new line after progress bar
+            bool openFile(int dirFd, const std::string &leaf, const std::string &rel,
+                          struct archive_entry *entry)
+            {
+                const mode_t mode = static_cast<mode_t>(archive_entry_perm(entry));
+                const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW;
+                int fd = ::openat(dirFd, leaf.c_str(), flags, mode | S_IWUSR);
+                if (fd < 0 && errno == ELOOP)
+                {
+                    // A symlink from an earlier entry is in the way; replace it.
+                    ::unlinkat(dirFd, leaf.c_str(), 0);
+                    fd = ::openat(dirFd, leaf.c_str(), flags, mode | S_IWUSR);
+                }
+                if (fd < 0)
+                {
+                    log_error("Could not open for writing: " + rel + ": " + strerror(errno));
+                    return false;
+                }
 
-            if (error < 0)
+                if (archive_entry_size_is_set(entry) && archive_entry_size(entry) > 0)
+                {
+                    if (archive_entry_sparse_count(entry) > 0)
+                    {
+                        // Sparse member: set the final size up front and let writeData()
+                        // pwrite() only the data regions, leaving the holes unallocated.
+                        if (::ftruncate(fd, archive_entry_size(entry)) != 0)
+                        {
+                            log_error("Could not size sparse file " + rel + ": " + strerror(errno));
+                            ::close(fd);
+                            return false;
+                        }
+                    }
+                    else
+                    {
+                        // Best effort: not every filesystem supports preallocation.
+                        ::fallocate(fd, 0, 0, archive_entry_size(entry));
+                    }
+                }
+
+                fileFd_ = fd;
+                fileRel_ = rel;
+                fileMode_ = mode;
+                fileHasMtime_ = archive_entry_mtime_is_set(entry);
+                if (fileHasMtime_)
+                    fileMtime_ = {archive_entry_mtime(entry), archive_entry_mtime_nsec(entry)};
+                return true;
+            }
+
+            bool closeFile()
             {
-                const git_error *e = git_error_last();
-                std::string msg = (e && e->message) ? e->message : "unknown error";
-                log_error("Git clone failed: " + msg);
-                if (repo)
+                int fd = fileFd_;
+                fileFd_ = -1;
+                if (::close(fd) != 0)
                 {
-                    git_repository_free(repo);
+                    log_error("Close failed for " + fileRel_ + ": " + strerror(errno));
+                    return false;
                 }
-                return false;
+                return true;
             }
 
-            git_repository_free(repo);
-            return true;
+            static bool writeAll(int fd, const char *data, size_t size, off_t offset)
+            {
+                while (size > 0)
+                {
+                    ssize_t n = ::pwrite(fd, data, size, offset);
+                    if (n < 0)
+                    {
+                        if (errno == EINTR)
+                            continue;
+                        return false;
+                    }
+                    data += n;
+                    size -= static_cast<size_t>(n);
+                    offset += n;
+                }
+                return true;
+            }
+
+            int rootFd_ = -1;
+            std::vector<DirMeta> deferredDirs_;
+
+            // The parent directory of the most recent entry, kept open for its siblings.
+            int parentFd_ = -1;
+            std::string parentRel_;
+
+            // The regular file currently being written, if any.
+            int fileFd_ = -1;
+            std::string fileRel_;
+            mode_t fileMode_ = 0;
+            bool fileHasMtime_ = false;
+            struct timespec fileMtime_ = {};
+        };
+
+        /**
+         * @struct ExtractItem
+         * One unit of work passed from the decoder thread to the writer: the start of an
+         * entry (with its own copy of the header), a block of file data, or the end of
+         * the current entry.
+         */
+        struct ExtractItem
+        {
+            struct EntryDeleter
+            {
+                void operator()(struct archive_entry *e) const { archive_entry_free(e); }
+            };
+
+            enum Kind
+            {
+                Begin,
+                Data,
+                End
+            } kind = End;
+            std::string rel;
+            std::unique_ptr<struct archive_entry, EntryDeleter> entry; // Begin only
+            std::vector<char> data;
+            int64_t offset = 0;
+        };
+
+        /**
+         * @brief The reader's last error or warning, which libarchive may leave unset.
+         */
+        static std::string archiveErrorString(struct archive *a)
+        {
+            const char *message = archive_error_string(a);
+            return message ? message : "unknown libarchive error";
         }
 
         /**
-         * @brief fetchSources:
-         *        - For each source, determines if it's a Git URL, remote URL, or local file
-         *        - If Git, calls cloneGitRepo
-         *        - If remote, calls downloadFile
-         *        - If local, copies the file
-         *        - If recognized as an archive, calls extractArchive (unless NOEXTRACT is in the name)
+         * @brief Registers decompression filters on a libarchive reader.
          *
-         * The results are tracked in 'intermediatePaths' for subsequent cleanup or reference.
+         * libarchive decodes gzip, xz and zstd on the calling thread. When a
+         * multi-threaded decoder is installed it is used instead through libarchive's
+         * external program filter, which also moves decompression into its own process:
+         * "xz -T0" decodes multi-block .xz files in parallel, pigz inflates on separate
+         * read/write/check threads, and pzstd decodes independent zstd frames in
+         * parallel. All other formats use the built-in filters.
+         */
+        static void configureDecompression(struct archive *a, const std::string &archivePath)
+        {
+            unsigned char magic[6] = {};
+            {
+                std::ifstream in(archivePath, std::ios::binary);
+                in.read(reinterpret_cast<char *>(magic), sizeof(magic));
+            }
+
+            static const unsigned char xzSig[] = {0xFD, '7', 'z', 'X', 'Z', 0x00};
+            static const unsigned char gzipSig[] = {0x1F, 0x8B};
+            static const unsigned char zstdSig[] = {0x28, 0xB5, 0x2F, 0xFD};
+
+            std::string threads = std::to_string(std::max(1u, std::thread::hardware_concurrency()));
+            bool external = false;
+            if (memcmp(magic, xzSig, sizeof(xzSig)) == 0 && !findInPath("xz").empty())
+            {
+                external = archive_read_support_filter_program_signature(
+                               a, "xz -dc -T0", xzSig, sizeof(xzSig)) == ARCHIVE_OK;
+            }
+            else if (memcmp(magic, gzipSig, sizeof(gzipSig)) == 0 && !findInPath("pigz").empty())
+            {
+                external = archive_read_support_filter_program_signature(
+                               a, "pigz -dc", gzipSig, sizeof(gzipSig)) == ARCHIVE_OK;
+            }
+            else if (memcmp(magic, zstdSig, sizeof(zstdSig)) == 0 && !findInPath("pzstd").empty())
+            {
+                std::string cmd = "pzstd -dc -p " + threads;
+                external = archive_read_support_filter_program_signature(
+                               a, cmd.c_str(), zstdSig, sizeof(zstdSig)) == ARCHIVE_OK;
+            }
+
+            // The built-in filter for the same format would outbid the program filter,
+            // so only register it when no external decoder was chosen.
+            if (!external || memcmp(magic, gzipSig, sizeof(gzipSig)) != 0)
+                archive_read_support_filter_gzip(a);
+            if (!external || memcmp(magic, xzSig, sizeof(xzSig)) != 0)
+                archive_read_support_filter_xz(a);
+            if (!external || memcmp(magic, zstdSig, sizeof(zstdSig)) != 0)
+                archive_read_support_filter_zstd(a);
+            archive_read_support_filter_bzip2(a);
+            archive_read_support_filter_lzip(a);
+            archive_read_support_filter_lz4(a);
+        }
+
+        /**
+         * @brief Extracts a recognized archive using libarchive.
+         *        Skips extraction if "NOEXTRACT" is in the file name.
          *
-         * @param sources The list of source strings from the STARBUILD.
-         * @param intermediatePaths A container to store file/directory names that we create (for cleanup).
-         * @param starbuildDir Path to the directory containing the STARBUILD file.
-         * @return True if all sources were processed successfully, false otherwise.
+         * The entries are written below destRoot. ExtractionPool passes a private
+         * staging directory here, moves the result into place afterwards and records
+         * an extraction stamp so later runs can skip the archive.
+         *
+         * @param archivePath The local path to the archive file.
+         * @param destRoot The directory the archive entries are written into.
+         * @param options Strip-components, include/exclude globs and destination subdir.
+         * @return True on successful extraction, false otherwise.
          */
-        bool fetchSources(const std::vector<std::string> &sources,
-                          std::vector<std::string> &intermediatePaths,
-                          const std::filesystem::path &starbuildDir)
+        bool extractArchive(const std::string &archivePath, const fs::path &destRoot = ".",
+                            const ExtractOptions &options = {})
         {
-            for (auto &src : sources)
+            // 1) If it doesn’t look like an archive, skip.
+            if (!isArchiveFile(archivePath))
             {
-                // 1) If it starts with "git+", treat as a Git repo
-                if (src.rfind("git+", 0) == 0)
+                log_message("Not an archive, skipping extraction: " + archivePath);
+                return true;
+            }
+
+            // 2) NOEXTRACT override
+            if (archivePath.find("NOEXTRACT") != std::string::npos)
+            {
+                log_message("NOEXTRACT flag found; skipping extraction: " + archivePath);
+                return true;
+            }
+
+            // 3) Proceed to extract (ExtractionPool has already checked the stamp)
+            log_message("Extracting archive: " + archivePath);
+            TraceSpan span("extract", "extractArchive");
+            span.arg("archive", archivePath);
+
+            struct archive *a = archive_read_new();
+            archive_read_support_format_zip(a);
+            archive_read_support_format_tar(a);
+            configureDecompression(a, archivePath);
+
+            if (archive_read_open_filename(a, archivePath.c_str(), kExtractReadBlockSize) != ARCHIVE_OK)
+            {
+                log_error("Failed to open archive: " + archivePath + " => " + archive_error_string(a));
+                archive_read_free(a);
+                return false;
+            }
+
+            ExtractionWriter writer(destRoot);
+            if (!writer.ok())
+            {
+                archive_read_free(a);
+                return false;
+            }
+
+            // Decode on a separate thread so decompression overlaps with filesystem
+            // writes; the writer below runs on this thread.
+            BoundedQueue<ExtractItem> queue(kExtractQueueBytes);
+            std::string readError;
+            std::thread decoder([&]
+                                {
+                tracer.nameThread("extract decoder");
+                TraceSpan decodeSpan("extract", "decode");
+                decodeSpan.arg("archive", archivePath);
+                struct archive_entry *entry;
+                int r;
+                // ARCHIVE_WARN (unknown pax keywords, unsupported ACLs, ...) still
+                // delivers a usable header or data block; only FAILED/FATAL abort.
+                while ((r = archive_read_next_header(a, &entry)) == ARCHIVE_OK || r == ARCHIVE_WARN)
                 {
-                    std::string gitUrl = src.substr(4);
-                    size_t frag = gitUrl.find_first_of("#?");
-                    if (frag != std::string::npos)
+                    if (r == ARCHIVE_WARN)
+                        log_warning(archivePath + ": " + archiveErrorString(a));
+                    ExtractItem begin;
+                    begin.kind = ExtractItem::Begin;
+                    if (!ExtractionWriter::relativeEntryPath(archive_entry_pathname(entry), begin.rel))
                     {
-                        gitUrl = gitUrl.substr(0, frag);
+                        log_warning("Skipping unsafe archive entry: " + std::string(archive_entry_pathname(entry)));
+                        archive_read_data_skip(a);
+                        continue;
+                    }
+                    // Filter on the header alone; skipped entries never reach the writer.
+                    if (!options.empty() && !options.map(begin.rel))
+                    {
+                        archive_read_data_skip(a);
+                        continue;
+                    }
+                    begin.entry.reset(archive_entry_clone(entry));
+                    if (!options.empty() && archive_entry_hardlink(entry))
+                    {
+                        // The target was never written if the options filtered it out
+                        std::string target;
+                        if (!ExtractionWriter::relativeEntryPath(archive_entry_hardlink(entry), target) ||
+                            !options.map(target))
+                        {
+                            log_warning("Skipping hardlink " + begin.rel + ": its target " +
+                                        archive_entry_hardlink(entry) + " is not extracted.");
+                            archive_read_data_skip(a);
+                            continue;
+                        }
+                        archive_entry_set_hardlink(begin.entry.get(), target.c_str());
+                    }
+                    if (!queue.push(std::move(begin), 1))
+                        return;
+
+                    if (archive_entry_filetype(entry) == AE_IFREG)
+                    {
+                        const void *buff;
+                        size_t size;
+                        la_int64_t offset;
+                        while ((r = archive_read_data_block(a, &buff, &size, &offset)) == ARCHIVE_OK ||
+                               r == ARCHIVE_WARN)
+                        {
+                            if (r == ARCHIVE_WARN)
+                                log_warning(archivePath + ": " + archiveErrorString(a));
+                            if (size == 0)
+                                continue;
+                            ExtractItem data;
+                            data.kind = ExtractItem::Data;
+                            data.offset = offset;
+                            data.data.assign(static_cast<const char *>(buff), static_cast<const char *>(buff) + size);
+                            if (!queue.push(std::move(data), size + 1))
+                                return;
+                        }
+                        if (r != ARCHIVE_EOF)
+                        {
+                            readError = "archive_read_data_block: " + std::string(archive_error_string(a));
+                            queue.close();
+                            return;
+                        }
                     }
 
-                    // Derive local directory name
-                    size_t pos = gitUrl.find_last_of('/');
-                    std::string repoName = (pos != std::string::npos) ? gitUrl.substr(pos + 1)
-                                                                      : gitUrl;
-                    // Remove trailing .git
-                    if (repoName.size() >= 4 && repoName.substr(repoName.size() - 4) == ".git")
+                    if (!queue.push(ExtractItem{}, 1))
+                        return;
+                }
+                if (r != ARCHIVE_EOF)
+                {
+                    readError = "Failed to read archive header in " + archivePath + ": " + archive_error_string(a);
+                }
+                queue.close(); });
+
+            bool writeOk = true;
+            ExtractItem item;
+            while (writeOk && queue.pop(item))
+            {
+                switch (item.kind)
+                {
+                case ExtractItem::Begin:
+                    writeOk = writer.beginEntry(item.rel, item.entry.get());
+                    break;
+                case ExtractItem::Data:
+                    writeOk = writer.writeData(item.data.data(), item.data.size(), item.offset);
+                    break;
+                case ExtractItem::End:
+                    writeOk = writer.endEntry();
+                    break;
+                }
+            }
+            if (!writeOk)
+            {
+                queue.abort();
+            }
+            decoder.join();
+
+            if (!readError.empty())
+            {
+                log_error(readError);
+            }
+            if (!writeOk || !readError.empty() || !writer.finish())
+            {
+                archive_read_free(a);
+                return false;
+            }
+
+            archive_read_close(a);
+            archive_read_free(a);
+            log_message("Extracted " + archivePath + " into " + destRoot.string() + ".");
+            return true;
+        }
+
+        /**
+         * @struct ExtractionStamp
+         * Written after an archive has been fully extracted and moved into place. Records
+         * what was extracted (the archive's SHA-256, plus its size and mtime as a cheap
+         * change check) and which top-level entries it produced. created is the subset
+         * of entries that did not exist before the archive was first extracted; only
+         * those are the archive's to remove on cleanup.
+         */
+        struct ExtractionStamp
+        {
+            std::string sha256;
+            uintmax_t size = 0;
+            int64_t mtimeNs = 0;
+            std::string options; // ExtractOptions::describe()
+            std::vector<std::string> entries;
+            std::vector<std::string> created;
+        };
+
+        /**
+         * @brief Location of the stamp for an archive: ".starpack-stamps/<file>.stamp"
+         *        next to the archive.
+         */
+        static fs::path extractionStampPath(const std::string &archivePath)
+        {
+            fs::path archive(archivePath);
+            return archive.parent_path() / ".starpack-stamps" / (archive.filename().string() + ".stamp");
+        }
+
+        /**
+         * @brief Computes the hex SHA-256 digest of a file, or "" if it can't be read.
+         */
+        static std::string sha256File(const std::string &path)
+        {
+            std::ifstream in(path, std::ios::binary);
+            if (!in)
+                return "";
+
+            EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+            EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr);
+            std::vector<char> buf(kExtractReadBlockSize);
+            while (in)
+            {
+                in.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+                EVP_DigestUpdate(ctx, buf.data(), static_cast<size_t>(in.gcount()));
+            }
+            unsigned char md[EVP_MAX_MD_SIZE];
+            unsigned int mdLen = 0;
+            EVP_DigestFinal_ex(ctx, md, &mdLen);
+            EVP_MD_CTX_free(ctx);
+
+            static const char hex[] = "0123456789abcdef";
+            std::string out;
+            out.reserve(mdLen * 2);
+            for (unsigned int i = 0; i < mdLen; ++i)
+            {
+                out.push_back(hex[md[i] >> 4]);
+                out.push_back(hex[md[i] & 0xF]);
+            }
+            return out;
+        }
+
+        /**
+         * @brief Reads size and mtime (in nanoseconds) of a file with a single stat().
+         */
+        static bool statSizeMtime(const std::string &path, uintmax_t &size, int64_t &mtimeNs)
+        {
+            struct stat st;
+            if (::stat(path.c_str(), &st) != 0)
+                return false;
+            size = static_cast<uintmax_t>(st.st_size);
+            mtimeNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+            return true;
+        }
+
+        static bool readExtractionStamp(const std::string &archivePath, ExtractionStamp &stamp)
+        {
+            fs::path stampPath = extractionStampPath(archivePath);
+            std::error_code ec;
+            if (!fs::exists(stampPath, ec))
+                return false;
+            try
+            {
+                YAML::Node node = YAML::LoadFile(stampPath.string());
+                stamp.sha256 = node["sha256"].as<std::string>();
+                stamp.size = node["size"].as<uintmax_t>();
+                stamp.mtimeNs = node["mtime_ns"].as<int64_t>();
+                if (node["options"])
+                    stamp.options = node["options"].as<std::string>();
+                stamp.entries.clear();
+                for (const auto &e : node["entries"])
+                    stamp.entries.push_back(e.as<std::string>());
+                stamp.created.clear();
+                if (node["created"])
+                {
+                    for (const auto &e : node["created"])
+                        stamp.created.push_back(e.as<std::string>());
+                }
+                else
+                {
+                    stamp.created = stamp.entries; // stamps written before "created" existed
+                }
+            }
+            catch (const std::exception &ex)
+            {
+                log_warning("Ignoring unreadable extraction stamp " + stampPath.string() + ": " + ex.what());
+                return false;
+            }
+            return true;
+        }
+
+        static bool writeExtractionStamp(const std::string &archivePath, const ExtractionStamp &stamp)
+        {
+            fs::path stampPath = extractionStampPath(archivePath);
+            std::error_code ec;
+            fs::create_directories(stampPath.parent_path(), ec);
+
+            YAML::Node node;
+            node["archive"] = fs::path(archivePath).filename().string();
+            node["sha256"] = stamp.sha256;
+            node["size"] = stamp.size;
+            node["mtime_ns"] = stamp.mtimeNs;
+            if (!stamp.options.empty())
+                node["options"] = stamp.options;
+            YAML::Node entries(YAML::NodeType::Sequence);
+            for (const auto &e : stamp.entries)
+                entries.push_back(e);
+            node["entries"] = entries;
+            YAML::Node created(YAML::NodeType::Sequence);
+            for (const auto &e : stamp.created)
+                created.push_back(e);
+            node["created"] = created;
+
+            YAML::Emitter emitter;
+            emitter << node;
+
+            // Write-then-rename so an interrupted run never leaves a truncated stamp.
+            fs::path tmp = stampPath;
+            tmp += ".tmp";
+            {
+                std::ofstream out(tmp, std::ios::trunc);
+                if (!out)
+                {
+                    log_warning("Could not write extraction stamp " + stampPath.string());
+                    return false;
+                }
+                out << emitter.c_str() << "\n";
+            }
+            fs::rename(tmp, stampPath, ec);
+            return !ec;
+        }
+
+        static void removeExtractionStamp(const std::string &archivePath)
+        {
+            std::error_code ec;
+            fs::remove(extractionStampPath(archivePath), ec);
+        }
+
+        /**
+         * @brief Replaces an archive's stamp with one that only lists what it created,
+         *        while it is being (re-)extracted. Having no entries, the stamp never
+         *        counts as up to date, but cleanup still removes what was created.
+         */
+        static void writePendingStamp(const std::string &archivePath, const std::vector<std::string> &created)
+        {
+            if (created.empty())
+            {
+                removeExtractionStamp(archivePath);
+                return;
+            }
+            ExtractionStamp pending;
+            pending.created = created;
+            writeExtractionStamp(archivePath, pending);
+        }
+
+        /**
+         * @brief Checks whether an archive's stamp says it is already extracted.
+         *
+         * The stamp must exist, describe the same archive extracted with the same
+         * options, and every recorded top-level entry (at least one) must still be present. The archive is only re-hashed when its size or
+         * mtime changed, so the common case costs two stat() calls plus one per entry.
+         * A stamp whose digest still matches after an mtime-only change is refreshed.
+         *
+         * @param digest Receives the archive's digest if it had to be computed.
+         */
+        static bool extractionUpToDate(const std::string &archivePath, const ExtractOptions &options,
+                                       std::string &digest)
+        {
+            ExtractionStamp stamp;
+            if (!readExtractionStamp(archivePath, stamp) || stamp.options != options.describe())
+                return false;
+            if (stamp.entries.empty())
+                return false; // nothing to check the extracted tree against
+
+            uintmax_t size;
+            int64_t mtimeNs;
+            if (!statSizeMtime(archivePath, size, mtimeNs))
+                return false;
+
+            if (size != stamp.size || mtimeNs != stamp.mtimeNs)
+            {
+                digest = sha256File(archivePath);
+                if (digest.empty() || digest != stamp.sha256)
+                    return false;
+                stamp.size = size;
+                stamp.mtimeNs = mtimeNs;
+                writeExtractionStamp(archivePath, stamp);
+            }
+
+            for (const auto &entry : stamp.entries)
+            {
+                std::error_code ec;
+                if (!fs::exists(fs::symlink_status(fs::path(".") / entry, ec)))
+                {
+                    log_warning("Extracted tree of " + archivePath + " is incomplete (missing " +
+                                entry + "); extracting again.");
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        /**
+         * @brief Moves a staged extraction result into place.
+         *
+         * Missing destinations are simply renamed. When both sides are directories the
+         * contents are merged entry by entry, and anything else in the way is replaced,
+         * which matches what a serial extraction over the same path would leave behind.
+         */
+        static bool mergeStagedTree(const fs::path &src, const fs::path &dst)
+        {
+            std::error_code ec;
+            auto dstStatus = fs::symlink_status(dst, ec);
+            if (!fs::exists(dstStatus))
+            {
+                fs::rename(src, dst, ec);
+                if (ec)
+                {
+                    log_error("Failed to move " + src.string() + " to " + dst.string() + ": " + ec.message());
+                    return false;
+                }
+                return true;
+            }
+
+            if (fs::is_directory(dstStatus) && fs::is_directory(fs::symlink_status(src, ec)))
+            {
+                bool ok = true;
+                for (const auto &child : fs::directory_iterator(src, ec))
+                {
+                    ok = mergeStagedTree(child.path(), dst / child.path().filename()) && ok;
+                }
+                fs::remove(src, ec);
+                return ok;
+            }
+
+            fs::remove_all(dst, ec);
+            fs::rename(src, dst, ec);
+            if (ec)
+            {
+                log_error("Failed to replace " + dst.string() + ": " + ec.message());
+                return false;
+            }
+            return true;
+        }
+
+        /**
+         * @class ExtractionPool
+         * @brief Bounded set of worker threads that extract source archives while
+         *        fetchSources() keeps downloading the remaining sources.
+         *
+         * Archives whose extraction stamp is still valid are skipped. Every other archive
+         * is extracted into its own staging directory under "<dest>/.starpack-extract".
+         * finish() waits for all workers and then merges the staged trees into the
+         * destination directory in submission order, so the result is the same as
+         * extracting one archive after another, and stamps each archive once its tree is
+         * in place. A destination that does not outlive the build (--tmpfs-build) is
+         * neither checked against nor recorded in stamps. Failures are collected and
+         * reported per archive instead of stopping at the first one.
+         */
+        class ExtractionPool
+        {
+        public:
+            explicit ExtractionPool(size_t workers, const fs::path &destRoot = ".", bool persistent = true)
+                : destRoot_(destRoot), stagingRoot_(destRoot / ".starpack-extract"), persistent_(persistent)
+            {
+                workers = std::max<size_t>(1, workers);
+                for (size_t i = 0; i < workers; ++i)
+                {
+                    threads_.emplace_back([this]
+                                          { workerLoop(); });
+                }
+            }
+
+            ~ExtractionPool()
+            {
+                // Reached without finish() only when fetching failed; drop queued work.
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    pending_.clear();
+                }
+                stop();
+                std::error_code ec;
+                fs::remove_all(stagingRoot_, ec);
+            }
+
+            ExtractionPool(const ExtractionPool &) = delete;
+            ExtractionPool &operator=(const ExtractionPool &) = delete;
+
+            /**
+             * @brief Queues an archive for extraction. Returns immediately.
+             */
+            void submit(const std::string &archivePath, const ExtractOptions &options = {})
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                size_t index = jobs_.size();
+                jobs_.push_back({archivePath, options, stagingRoot_ / std::to_string(index), false, "", {}});
+                pending_.push_back(index);
+                cv_.notify_one();
+            }
+
+            /**
+             * @brief Waits for all queued archives, then moves their contents into place.
+             *
+             * @return True if every archive was extracted and merged successfully.
+             */
+            bool finish()
+            {
+                stop();
+
+                TraceSpan span("extract", "merge");
+                bool ok = true;
+                for (auto &job : jobs_)
+                {
+                    if (!job.succeeded)
+                    {
+                        log_error("Extraction failed for archive: " + job.archivePath);
+                        ok = false;
+                        continue;
+                    }
+
+                    std::error_code ec;
+                    if (!fs::exists(job.stagingDir, ec))
+                        continue; // skipped (already extracted, NOEXTRACT, ...)
+
+                    ExtractionStamp stamp;
+                    stamp.sha256 = job.digest;
+                    stamp.options = job.options.describe();
+                    statSizeMtime(job.archivePath, stamp.size, stamp.mtimeNs);
+
+                    // Every staged name is checked by extractionUpToDate(), but only names
+                    // that did not exist yet (or that the archive's previous stamp already
+                    // claimed) are removed on cleanup, so files of the same name that were
+                    // there before extraction survive.
+                    for (const auto &child : fs::directory_iterator(job.stagingDir, ec))
+                    {
+                        std::string name = child.path().filename().string();
+                        std::error_code existsEc;
+                        bool existed = fs::exists(fs::symlink_status(destRoot_ / name, existsEc));
+                        if (!existed || std::find(job.previouslyCreated.begin(), job.previouslyCreated.end(),
+                                                  name) != job.previouslyCreated.end())
+                        {
+                            stamp.created.push_back(name);
+                        }
+                        stamp.entries.push_back(std::move(name));
+                    }
+                    std::sort(stamp.entries.begin(), stamp.entries.end());
+                    std::sort(stamp.created.begin(), stamp.created.end());
+
+                    if (persistent_)
+                        writePendingStamp(job.archivePath, stamp.created);
+
+                    bool merged = true;
+                    for (const auto &name : stamp.entries)
+                    {
+                        merged = mergeStagedTree(job.stagingDir / name, destRoot_ / name) && merged;
+                    }
+                    if (!merged)
+                    {
+                        log_error("Could not move extracted files of " + job.archivePath + " into place.");
+                        ok = false;
+                        continue;
+                    }
+                    if (persistent_ && !stamp.sha256.empty())
+                    {
+                        writeExtractionStamp(job.archivePath, stamp);
+                    }
+                }
+
+                std::error_code ec;
+                fs::remove_all(stagingRoot_, ec);
+                return ok;
+            }
+
+        private:
+            struct Job
+            {
+                std::string archivePath;
+                ExtractOptions options;
+                fs::path stagingDir;
+                bool succeeded;
+                std::string digest;
+                std::vector<std::string> previouslyCreated; // from the stamp replaced by this run
+            };
+
+            void workerLoop()
+            {
+                tracer.nameThread("extract worker");
+                while (true)
+                {
+                    size_t index;
+                    std::string archivePath;
+                    ExtractOptions options;
+                    fs::path stagingDir;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex_);
+                        cv_.wait(lock, [this]
+                                 { return stopping_ || !pending_.empty(); });
+                        if (pending_.empty())
+                            return;
+                        index = pending_.front();
+                        pending_.pop_front();
+                        archivePath = jobs_[index].archivePath;
+                        options = jobs_[index].options;
+                        stagingDir = jobs_[index].stagingDir;
+                    }
+
+                    bool ok = false;
+                    std::string digest;
+                    std::vector<std::string> previouslyCreated;
+                    try
+                    {
+                        if (persistent_ && extractionUpToDate(archivePath, options, digest))
+                        {
+                            log_message("Archive already extracted, skipping: " + archivePath);
+                            ok = true;
+                        }
+                        else
+                        {
+                            // Invalidate the old stamp first so an interrupted run is never
+                            // mistaken for a complete one, but keep what it created.
+                            if (persistent_)
+                            {
+                                ExtractionStamp previous;
+                                if (readExtractionStamp(archivePath, previous))
+                                    previouslyCreated = previous.created;
+                                writePendingStamp(archivePath, previouslyCreated);
+                            }
+                            ok = extractArchive(archivePath, stagingDir, options);
+                            std::error_code ec;
+                            if (persistent_ && ok && digest.empty() && fs::exists(stagingDir, ec))
+                            {
+                                TraceSpan hashSpan("extract", "sha256");
+                                digest = sha256File(archivePath);
+                            }
+                        }
+                    }
+                    catch (const std::exception &ex)
+                    {
+                        log_error("Exception while extracting " + archivePath + ": " + ex.what());
+                    }
+
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    jobs_[index].succeeded = ok;
+                    jobs_[index].digest = digest;
+                    jobs_[index].previouslyCreated = std::move(previouslyCreated);
+                }
+            }
+
+            void stop()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    stopping_ = true;
+                }
+                cv_.notify_all();
+                for (auto &t : threads_)
+                {
+                    if (t.joinable())
+                        t.join();
+                }
+            }
+
+            fs::path destRoot_;
+            fs::path stagingRoot_;
+            bool persistent_;
+            std::vector<std::thread> threads_;
+            std::deque<Job> jobs_;
+            std::deque<size_t> pending_;
+            std::mutex mutex_;
+            std::condition_variable cv_;
+            bool stopping_ = false;
+        };
+
+        /**
+         * @brief Number of archives extracted concurrently by fetchSources().
+         *
+         * Decompression is CPU bound, but extraction also competes with downloads and
+         * disk writes, so the pool is capped at a handful of workers.
+         */
+        static size_t extractionWorkerCount()
+        {
+            unsigned hw = std::thread::hardware_concurrency();
+            return std::clamp<size_t>(hw == 0 ? 1 : hw, 1, 4);
+        }
+
+        /**
+         * @struct GitProgress
+         * Contains a single double to track the last printed progress percentage in the clone process.
+         */
+        struct GitProgress
+        {
+            double lastPercent = 0.0;
+        };
+
+        /**
+         * @brief Callback invoked by libgit2 during clone/fetch progress. Displays a combined
+         *        "receiving + indexing" progress bar.
+         */
+        static int transferProgress(const git_transfer_progress *stats, void *payload)
+        {
+            // Avoid dividing by zero if total_objects not known
+            if (stats->total_objects == 0)
+            {
+                return 0;
+            }
+
+            double receivingWeight = 0.5;
+            double indexingWeight = 0.5;
+            double receiveRatio = static_cast<double>(stats->received_objects) / stats->total_objects;
+            double indexRatio = static_cast<double>(stats->indexed_objects) / stats->total_objects;
+            double overallProgress = receivingWeight * receiveRatio + indexingWeight * indexRatio;
+
+            double percent = overallProgress * 100.0;
+
+            GitProgress *gp = static_cast<GitProgress *>(payload);
+            if (percent - gp->lastPercent >= 1.0)
+            {
+                gp->lastPercent = percent;
+
+                int barWidth = 50;
+                int pos = static_cast<int>(overallProgress * barWidth);
+
+                std::string bar(barWidth, ' ');
+                for (int i = 0; i < pos; ++i)
+                {
+                    bar[i] = '#';
+                }
+
+                fprintf(stderr, "\r[%-50s] %3.0f%%  (recv %.0f%%, idx %.0f%%)",
+                        bar.c_str(), percent, receiveRatio * 100.0, indexRatio * 100.0);
+                fflush(stderr);
+            }
+            return 0;
+        }
+
+        /**
+         * @brief Clones a Git repo to the specified directory, showing a progress bar via libgit2.
+         *
+         * Skips if the target directory already exists and is non-empty.
+         *
+         * @param url The remote Git repository URL.
+         * @param destDir The local directory where it will be cloned.
+         * @return True on success, false otherwise.
+         */
+        bool cloneGitRepo(const std::string &url, const std::string &destDir)
+        {
+            TraceSpan span("fetch", "clone");
+            span.arg("url", url);
+            // If directory is non-empty, skip clone to avoid conflicts
+            if (std::filesystem::exists(destDir) && !std::filesystem::is_empty(destDir))
+            {
+                log_message("Directory '" + destDir + "' already exists; skipping clone...");
+                return true;
+            }
+
+            // Use default clone options with a custom fetch progress callback
+            git_clone_options cloneOpts = GIT_CLONE_OPTIONS_INIT;
+            cloneOpts.fetch_opts.callbacks.transfer_progress = transferProgress;
+
+            GitProgress gp;
+            cloneOpts.fetch_opts.callbacks.payload = &gp;
+
+            git_repository *repo = nullptr;
+            int error = git_clone(&repo, url.c_str(), destDir.c_str(), &cloneOpts);
+
+            fprintf(stderr, "\n"); // new line after progress bar
+
+            if (error < 0)
+            {
+                const git_error *e = git_error_last();
+                std::string msg = (e && e->message) ? e->message : "unknown error";
+                log_error("Git clone failed: " + msg);
+                if (repo)
+                {
+                    git_repository_free(repo);
+                }
+                return false;
+            }
+
+            git_repository_free(repo);
+            return true;
+        }
+
+        /**
+         * @brief fetchSources:
+         *        - For each source, determines if it's a Git URL, remote URL, or local file
+         *        - If Git, calls cloneGitRepo
+         *        - If remote, calls downloadFile
+         *        - If local, copies the file
+         *        - If recognized as an archive, queues it on an ExtractionPool so it is
+         *          extracted in the background while the remaining sources are fetched
+         *
+         * The results are tracked in 'intermediatePaths' for subsequent cleanup or reference.
+         *
+         * @param sources The list of source strings from the STARBUILD.
+         * @param intermediatePaths A container to store file/directory names that we create (for cleanup).
+         * @param starbuildDir Path to the directory containing the STARBUILD file.
+         * @param extractOptions Per-archive extraction options, keyed by file name.
+         * @param workDir Where archives are extracted and Git repos cloned. Downloads and
+         *        local copies always stay in the current directory. Anything other than
+         *        "." is taken to be a throwaway tree, so extraction stamps are not used.
+         * @return True if all sources were processed successfully, false otherwise.
+         */
+        bool fetchSources(const std::vector<std::string> &sources,
+                          std::vector<std::string> &intermediatePaths,
+                          const std::filesystem::path &starbuildDir,
+                          const std::unordered_map<std::string, ExtractOptions> &extractOptions,
+                          const std::filesystem::path &workDir)
+        {
+            TraceSpan span("fetch", "fetchSources");
+            ExtractionPool extractor(extractionWorkerCount(), workDir, workDir == ".");
+            auto optionsFor = [&](const std::string &file)
+            {
+                auto it = extractOptions.find(file);
+                return it != extractOptions.end() ? it->second : ExtractOptions{};
+            };
+
+            for (auto &src : sources)
+            {
+                // 1) If it starts with "git+", treat as a Git repo
+                if (src.rfind("git+", 0) == 0)
+                {
+                    std::string gitUrl = src.substr(4);
+                    size_t frag = gitUrl.find_first_of("#?");
+                    if (frag != std::string::npos)
+                    {
+                        gitUrl = gitUrl.substr(0, frag);
+                    }
+
+                    // Derive local directory name
+                    size_t pos = gitUrl.find_last_of('/');
+                    std::string repoName = (pos != std::string::npos) ? gitUrl.substr(pos + 1)
+                                                                      : gitUrl;
+                    // Remove trailing .git
+                    if (repoName.size() >= 4 && repoName.substr(repoName.size() - 4) == ".git")
+                    {
+                        repoName.erase(repoName.size() - 4);
+                    }
+
+                    std::string cloneDir = (workDir / repoName).string();
+                    if (std::filesystem::exists(cloneDir) && !std::filesystem::is_empty(cloneDir))
+                    {
+                        log_message("Directory '" + cloneDir + "' already exists; skipping clone...");
+                        intermediatePaths.push_back(repoName);
+                        continue;
+                    }
+
+                    log_message("Cloning Git repo: " + gitUrl + " => " + cloneDir);
+                    if (!cloneGitRepo(gitUrl, cloneDir))
+                    {
+                        return false;
+                    }
+                    intermediatePaths.push_back(repoName);
+                    continue;
+                }
+
+                // 2) If there's a custom filename in "name::URL" format
+                std::string customFilename;
+                std::string actualUrl;
+                size_t doubleColonPos = src.find("::");
+                if (doubleColonPos != std::string::npos)
+                {
+                    customFilename = src.substr(0, doubleColonPos);
+                    actualUrl = src.substr(doubleColonPos + 2);
+                }
+
+                // If we do have a custom name+URL
+                if (!customFilename.empty() && !actualUrl.empty())
+                {
+                    bool isRemote = (actualUrl.find("://") != std::string::npos);
+                    if (!isRemote)
+                    {
+                        log_error("Invalid custom URL syntax: " + src);
+                        return false;
+                    }
+                    if (!std::filesystem::exists(customFilename))
+                    {
+                        log_message("Downloading to custom file name: " + customFilename + " from " + actualUrl);
+                        if (!downloadFile(actualUrl, customFilename))
+                        {
+                            log_error("Could not download " + actualUrl);
+                            return false;
+                        }
+                    }
+                    else
+                    {
+                        log_message("File already exists, skipping download: " + customFilename);
+                    }
+                    intermediatePaths.push_back(customFilename);
+                    // Possibly extract if recognized as an archive
+                    if (isArchiveFile(customFilename))
+                    {
+                        extractor.submit(customFilename, optionsFor(customFilename));
+                    }
+                    continue;
+                }
+
+                // 3) Otherwise, normal fallback: check if it's a remote URL or local file
+                bool isURL = (src.find("://") != std::string::npos);
+                std::string filename;
+
+                if (isURL)
+                {
+                    size_t pos = src.find_last_of("/");
+                    filename = (pos != std::string::npos) ? src.substr(pos + 1) : src;
+                    if (filename.empty())
+                    {
+                        filename = "source.tar";
+                    }
+                    if (!std::filesystem::exists(filename))
+                    {
+                        if (!downloadFile(src, filename))
+                        {
+                            log_error("Could not download " + src);
+                            return false;
+                        }
+                    }
+                    else
+                    {
+                        log_message("File already exists, skipping download: " + filename);
+                    }
+                }
+                else
+                {
+                    // local file
+                    std::filesystem::path srcPath = starbuildDir / src;
+                    if (!std::filesystem::exists(srcPath))
+                    {
+                        log_error("Local source file does not exist: " + srcPath.string());
+                        return false;
+                    }
+                    filename = srcPath.filename().string();
+                    if (!std::filesystem::exists(filename))
+                    {
+                        try
+                        {
+                            std::filesystem::copy_file(srcPath, filename,
+                                                       std::filesystem::copy_options::overwrite_existing);
+                            log_message("Copied local file: " + filename);
+                        }
+                        catch (std::filesystem::filesystem_error &e)
+                        {
+                            log_error(std::string("Failed to copy local file: ") + e.what());
+                            return false;
+                        }
+                    }
+                    else
+                    {
+                        log_message("Local file already present: " + filename);
+                    }
+                }
+
+                intermediatePaths.push_back(filename);
+                if (isArchiveFile(filename))
+                {
+                    extractor.submit(filename, optionsFor(filename));
+                }
+            }
+
+            return extractor.finish();
+        }
+
+        /**
+         * @class Environment
+         * @brief An explicit KEY=VALUE environment block for child processes.
+         *
+         * Starts from a copy of our own environment; set() replaces an existing
+         * variable in place or appends a new one.
+         */
+        class Environment
+        {
+        public:
+            static Environment current()
+            {
+                Environment env;
+                for (char **e = environ; e && *e; ++e)
+                    env.vars_.emplace_back(*e);
+                return env;
+            }
+
+            void set(const std::string &key, const std::string &value)
+            {
+                auto it = find(key);
+                if (it != vars_.end())
+                    *it = key + "=" + value;
+                else
+                    vars_.push_back(key + "=" + value);
+            }
+
+            void unset(const std::string &key)
+            {
+                auto it = find(key);
+                if (it != vars_.end())
+                    vars_.erase(it);
+            }
+
+            /**
+             * @brief Returns the value of key, or nullptr if it is not set.
+             */
+            const char *get(const std::string &key) const
+            {
+                for (const auto &v : vars_)
+                {
+                    if (v.size() > key.size() && v[key.size()] == '=' && v.compare(0, key.size(), key) == 0)
+                        return v.c_str() + key.size() + 1;
+                }
+                return nullptr;
+            }
+
+            const std::vector<std::string> &entries() const { return vars_; }
+
+        private:
+            std::vector<std::string>::iterator find(const std::string &key)
+            {
+                return std::find_if(vars_.begin(), vars_.end(), [&](const std::string &v)
+                                    { return v.size() > key.size() && v[key.size()] == '=' &&
+                                             v.compare(0, key.size(), key) == 0; });
+            }
+
+            std::vector<std::string> vars_;
+        };
+
+        /**
+         * @struct ProcessSpec
+         * What to launch: argv[0] must be an absolute path (no $PATH lookup happens in
+         * the child), env is passed as-is, and each (parentFd, childFd) pair in fds is
+         * made available to the child under childFd. All other descriptors we own are
+         * close-on-exec. If cgroupProcsFd is set (an open cgroup.procs), the child moves
+         * itself into that cgroup before exec, so nothing it runs escapes the cgroup.
+         * With newProcessGroup the child leads its own process group (pgid == pid), so
+         * the whole job can be signalled with kill(-pid, ...). A non-empty cwd is the
+         * child's working directory; otherwise it inherits ours.
+         */
+        struct ProcessSpec
+        {
+            std::vector<std::string> argv;
+            Environment env;
+            std::vector<std::pair<int, int>> fds;
+            int cgroupProcsFd = -1;
+            bool newProcessGroup = false;
+            std::string cwd;
+        };
+
+        /**
+         * @struct ProcessResult
+         * Raw wait status and resource usage of a finished child, as reported by wait4().
+         */
+        struct ProcessResult
+        {
+            int status = -1;
+            struct rusage usage = {};
+            std::chrono::steady_clock::duration wallTime{};
+
+            bool succeeded() const { return WIFEXITED(status) && WEXITSTATUS(status) == 0; }
+
+            /**
+             * @brief Folds another child's usage into this one (for pipelines): times and
+             *        counters add up, peak RSS is the larger of the two.
+             */
+            void accumulate(const ProcessResult &other)
+            {
+                auto addTime = [](timeval &a, const timeval &b)
+                {
+                    a.tv_sec += b.tv_sec;
+                    a.tv_usec += b.tv_usec;
+                    if (a.tv_usec >= 1000000)
+                    {
+                        a.tv_sec += 1;
+                        a.tv_usec -= 1000000;
+                    }
+                };
+                addTime(usage.ru_utime, other.usage.ru_utime);
+                addTime(usage.ru_stime, other.usage.ru_stime);
+                usage.ru_maxrss = std::max(usage.ru_maxrss, other.usage.ru_maxrss);
+                usage.ru_inblock += other.usage.ru_inblock;
+                usage.ru_oublock += other.usage.ru_oublock;
+                usage.ru_nvcsw += other.usage.ru_nvcsw;
+                usage.ru_nivcsw += other.usage.ru_nivcsw;
+                if (status == -1 || succeeded())
+                    status = other.status;
+            }
+        };
+
+        /**
+         * @struct PhaseContext
+         * How runWithBash() should run a build phase, and what came of it.
+         */
+        struct PhaseContext
+        {
+            fs::path logPath;                     ///< Capture output into this log (see PhaseLog) if set
+            int cgroupProcsFd = -1;               ///< Start the script in this cgroup if set
+            std::chrono::seconds timeout{0};      ///< Wall-clock limit, 0 = none
+            std::chrono::seconds hangTimeout{0};  ///< Limit without CPU use or output, 0 = none
+            ProcessResult result;                 ///< Exit status, wall time and rusage of the run
+            std::string abortReason;              ///< "timeout", "hang" or "interrupted" if we killed it
+            fs::path workingDirectory;            ///< Run the script here instead of our own directory if set
+        };
+
+        /**
+         * @brief Starts a child process with vfork()+execve().
+         *
+         * No intermediate shell is involved. Everything the child needs is prepared up
+         * front so the vfork child only performs dup2()/fcntl()/execve() before it is
+         * replaced. exec failures are reported back through a close-on-exec pipe.
+         *
+         * @return The child's pid, or -1 (with error describing why) on failure.
+         */
+        static pid_t spawnProcess(const ProcessSpec &spec, std::string &error)
+        {
+            if (spec.argv.empty())
+            {
+                error = "empty argv";
+                return -1;
+            }
+
+            std::vector<char *> argv;
+            for (const auto &a : spec.argv)
+                argv.push_back(const_cast<char *>(a.c_str()));
+            argv.push_back(nullptr);
+
+            std::vector<char *> envp;
+            for (const auto &e : spec.env.entries())
+                envp.push_back(const_cast<char *>(e.c_str()));
+            envp.push_back(nullptr);
+
+            std::vector<int> fromFds, toFds;
+            for (const auto &[from, to] : spec.fds)
+            {
+                fromFds.push_back(from);
+                toFds.push_back(to);
+            }
+            const size_t fdCount = fromFds.size();
+            const int cgroupFd = spec.cgroupProcsFd;
+            const bool newProcessGroup = spec.newProcessGroup;
+
+            int errPipe[2];
+            if (::pipe2(errPipe, O_CLOEXEC) != 0)
+            {
+                error = std::string("pipe2: ") + strerror(errno);
+                return -1;
+            }
+
+            pid_t pid = ::vfork();
+            if (pid == 0)
+            {
+                if (newProcessGroup)
+                    ::setpgid(0, 0);
+                // Join the cgroup first: dup2() below may reuse cgroupFd's number
+                if (cgroupFd >= 0 && ::write(cgroupFd, "0", 1) != 1)
+                {
+                    int err = errno;
+                    ::write(errPipe[1], &err, sizeof(err));
+                    ::_exit(127);
+                }
+                for (size_t i = 0; i < fdCount; ++i)
+                {
+                    if (fromFds[i] == toFds[i])
+                        ::fcntl(toFds[i], F_SETFD, 0);
+                    else
+                        ::dup2(fromFds[i], toFds[i]);
+                }
+                if (!spec.cwd.empty() && ::chdir(spec.cwd.c_str()) != 0)
+                {
+                    int err = errno;
+                    ::write(errPipe[1], &err, sizeof(err));
+                    ::_exit(127);
+                }
+                ::execve(argv[0], argv.data(), envp.data());
+                int err = errno;
+                ::write(errPipe[1], &err, sizeof(err));
+                ::_exit(127);
+            }
+            ::close(errPipe[1]);
+
+            if (pid < 0)
+            {
+                error = std::string("vfork: ") + strerror(errno);
+                ::close(errPipe[0]);
+                return -1;
+            }
+
+            int childErr = 0;
+            ssize_t n;
+            do
+            {
+                n = ::read(errPipe[0], &childErr, sizeof(childErr));
+            } while (n < 0 && errno == EINTR);
+            ::close(errPipe[0]);
+
+            if (n == sizeof(childErr))
+            {
+                ::waitpid(pid, nullptr, 0);
+                error = "exec " + spec.argv[0] + ": " + strerror(childErr);
+                return -1;
+            }
+            return pid;
+        }
+
+        /**
+         * @brief Waits for a child started by spawnProcess(), collecting its rusage.
+         */
+        static bool waitProcess(pid_t pid, ProcessResult &result)
+        {
+            pid_t r;
+            do
+            {
+                r = ::wait4(pid, &result.status, 0, &result.usage);
+            } while (r < 0 && errno == EINTR);
+            return r == pid;
+        }
+
+        /**
+         * @brief Spawns a process and waits for it to finish.
+         *
+         * @return False if the process could not be started or waited for; the exit
+         *         status itself is left in result.
+         */
+        static bool runProcess(const ProcessSpec &spec, ProcessResult &result)
+        {
+            auto start = std::chrono::steady_clock::now();
+            std::string error;
+            pid_t pid = spawnProcess(spec, error);
+            if (pid < 0)
+            {
+                log_error("Failed to launch " + spec.argv[0] + ": " + error);
+                return false;
+            }
+            bool ok = waitProcess(pid, result);
+            result.wallTime = std::chrono::steady_clock::now() - start;
+            return ok;
+        }
+
+        /**
+         * @brief Puts a script into an anonymous in-memory file (memfd) so it can be
+         *        handed to bash as /dev/fd/N instead of on the command line.
+         *
+         * Falls back to an unlinked temporary file where memfd_create() is unavailable.
+         *
+         * @return A readable descriptor positioned at offset 0, or -1 on failure.
+         */
+        static int createScriptFd(const std::string &script)
+        {
+            int fd = ::memfd_create("starbuild-script", MFD_CLOEXEC);
+            if (fd < 0)
+            {
+                char tmpl[] = "/tmp/starbuild-script-XXXXXX";
+                fd = ::mkostemp(tmpl, O_CLOEXEC);
+                if (fd < 0)
+                    return -1;
+                ::unlink(tmpl);
+            }
+
+            size_t off = 0;
+            while (off < script.size())
+            {
+                ssize_t n = ::write(fd, script.data() + off, script.size() - off);
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    ::close(fd);
+                    return -1;
+                }
+                off += static_cast<size_t>(n);
+            }
+            ::lseek(fd, 0, SEEK_SET);
+            return fd;
+        }
+
+        /**
+         * @class PhaseLog
+         * @brief Sink for a phase's stdout/stderr: compresses it into a .zst log file on
+         *        the fly, keeps the last logTailLines lines for error reports and
+         *        optionally tees to the terminal.
+         */
+        class PhaseLog
+        {
+        public:
+            /**
+             * @brief Build output is highly repetitive, so the fastest level already
+             *        compresses it well without slowing the phase down.
+             */
+            static constexpr int kCompressionLevel = 1;
+
+            PhaseLog() = default;
+            ~PhaseLog() { close(); }
+            PhaseLog(const PhaseLog &) = delete;
+            PhaseLog &operator=(const PhaseLog &) = delete;
+
+            bool open(const fs::path &path)
+            {
+                std::error_code ec;
+                fs::create_directories(path.parent_path(), ec);
+                file_.open(path, std::ios::binary | std::ios::trunc);
+                cctx_ = ZSTD_createCCtx();
+                if (!file_.is_open() || !cctx_)
+                {
+                    log_warning("Could not create log file " + path.string());
+                    return false;
+                }
+                ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, kCompressionLevel);
+                out_.resize(ZSTD_CStreamOutSize());
+                path_ = path;
+                return true;
+            }
+
+            /**
+             * @brief Takes a chunk read from the child's stdout (fd 1) or stderr (fd 2);
+             *        stream -1 only logs (for our own notes, e.g. watchdog dumps).
+             */
+            void write(const char *data, size_t size, int stream)
+            {
+                if (teePhaseOutput && stream >= 0)
+                {
+                    size_t off = 0;
+                    while (off < size)
+                    {
+                        ssize_t n = ::write(stream, data + off, size - off);
+                        if (n < 0 && errno == EINTR)
+                            continue;
+                        if (n <= 0)
+                            break;
+                        off += static_cast<size_t>(n);
+                    }
+                }
+                compress(data, size, ZSTD_e_continue);
+                remember(data, size);
+            }
+
+            /**
+             * @brief Makes everything written so far readable from the log file.
+             */
+            void flush() { compress(nullptr, 0, ZSTD_e_flush); }
+
+            void close()
+            {
+                if (cctx_)
+                {
+                    compress(nullptr, 0, ZSTD_e_end);
+                    ZSTD_freeCCtx(cctx_);
+                    cctx_ = nullptr;
+                }
+                if (file_.is_open())
+                    file_.close();
+            }
+
+            const fs::path &path() const { return path_; }
+
+            /**
+             * @brief The last logged lines, oldest first.
+             */
+            std::vector<std::string> tail() const
+            {
+                std::vector<std::string> lines(lines_.begin(), lines_.end());
+                if (!partial_.empty())
+                    lines.push_back(partial_);
+                return lines;
+            }
+
+        private:
+            void compress(const char *data, size_t size, ZSTD_EndDirective mode)
+            {
+                if (!cctx_)
+                    return;
+                ZSTD_inBuffer in{data, size, 0};
+                size_t remaining;
+                do
+                {
+                    ZSTD_outBuffer out{out_.data(), out_.size(), 0};
+                    remaining = ZSTD_compressStream2(cctx_, &out, &in, mode);
+                    if (ZSTD_isError(remaining))
+                    {
+                        log_warning(std::string("Log compression failed: ") + ZSTD_getErrorName(remaining));
+                        ZSTD_freeCCtx(cctx_);
+                        cctx_ = nullptr;
+                        return;
+                    }
+                    file_.write(out_.data(), static_cast<std::streamsize>(out.pos));
+                } while (mode == ZSTD_e_continue ? in.pos < in.size : remaining != 0);
+                if (mode != ZSTD_e_continue)
+                    file_.flush();
+            }
+
+            /**
+             * @brief Feeds the tail ring buffer. A carriage return starts the line over,
+             *        so progress bars keep only what the terminal would show.
+             */
+            void remember(const char *data, size_t size)
+            {
+                if (logTailLines == 0)
+                    return;
+                for (size_t i = 0; i < size; ++i)
+                {
+                    char c = data[i];
+                    if (c == '\n')
+                    {
+                        lines_.push_back(std::move(partial_));
+                        partial_.clear();
+                        if (lines_.size() > logTailLines)
+                            lines_.pop_front();
+                    }
+                    else if (c == '\r')
+                        partial_.clear();
+                    else if (partial_.size() < 4096)
+                        partial_ += c;
+                }
+            }
+
+            fs::path path_;
+            std::ofstream file_;
+            ZSTD_CCtx *cctx_ = nullptr;
+            std::vector<char> out_;
+            std::deque<std::string> lines_;
+            std::string partial_;
+        };
+
+        /**
+         * @brief Reads the first line of a (typically /proc or /sys) file.
+         */
+        static std::string readFirstLine(const std::string &path)
+        {
+            std::ifstream in(path);
+            std::string line;
+            std::getline(in, line);
+            return trim(line);
+        }
+
+        /**
+         * @struct ProcInfo
+         * The parts of /proc/<pid>/stat the phase watchdog needs.
+         */
+        struct ProcInfo
+        {
+            pid_t pid = 0;
+            pid_t ppid = 0;
+            pid_t pgrp = 0;
+            char state = '?';
+            uint64_t cpuTicks = 0; // utime + stime
+            std::string comm;
+        };
+
+        static std::vector<ProcInfo> listProcesses()
+        {
+            std::vector<ProcInfo> procs;
+            std::error_code ec;
+            for (const auto &entry : fs::directory_iterator("/proc", ec))
+            {
+                const std::string name = entry.path().filename().string();
+                if (name.empty() || !std::all_of(name.begin(), name.end(), ::isdigit))
+                    continue;
+                std::ifstream in(entry.path() / "stat");
+                std::string line;
+                if (!std::getline(in, line))
+                    continue;
+                // "pid (comm) state ppid pgrp session tty tpgid flags minflt cminflt majflt cmajflt utime stime ..."
+                size_t open = line.find('(');
+                size_t close = line.rfind(')');
+                if (open == std::string::npos || close == std::string::npos)
+                    continue;
+                ProcInfo p;
+                p.pid = static_cast<pid_t>(std::atol(name.c_str()));
+                p.comm = line.substr(open + 1, close - open - 1);
+                std::stringstream ss(line.substr(close + 2));
+                std::string skip;
+                uint64_t utime = 0, stime = 0;
+                ss >> p.state >> p.ppid >> p.pgrp;
+                for (int i = 0; i < 8; ++i)
+                    ss >> skip;
+                ss >> utime >> stime;
+                p.cpuTicks = utime + stime;
+                procs.push_back(p);
+            }
+            return procs;
+        }
+
+        /**
+         * @brief Processes belonging to the job started as root: its process group plus
+         *        any descendants that moved to a group of their own.
+         */
+        static std::vector<ProcInfo> jobProcesses(pid_t root)
+        {
+            std::vector<ProcInfo> all = listProcesses();
+            std::unordered_map<pid_t, pid_t> parent;
+            for (const auto &p : all)
+                parent[p.pid] = p.ppid;
+            std::vector<ProcInfo> job;
+            for (const auto &p : all)
+            {
+                bool member = p.pgrp == root;
+                for (pid_t q = p.pid; !member && q > 1; q = parent.count(q) ? parent[q] : 0)
+                    member = q == root;
+                if (member)
+                    job.push_back(p);
+            }
+            return job;
+        }
+
+        /**
+         * @brief Renders the job's process tree with state, wchan, command line and,
+         *        where readable (root), the kernel stack of each process.
+         */
+        static std::string describeProcessTree(pid_t root)
+        {
+            std::vector<ProcInfo> job = jobProcesses(root);
+            std::unordered_set<pid_t> members;
+            for (const auto &p : job)
+                members.insert(p.pid);
+
+            std::string out;
+            std::function<void(const ProcInfo &, int)> print = [&](const ProcInfo &p, int depth)
+            {
+                std::string base = "/proc/" + std::to_string(p.pid);
+                std::string wchan = readFirstLine(base + "/wchan");
+                std::ifstream cmdIn(base + "/cmdline", std::ios::binary);
+                std::string cmd((std::istreambuf_iterator<char>(cmdIn)), std::istreambuf_iterator<char>());
+                std::replace(cmd.begin(), cmd.end(), '\0', ' ');
+                if (cmd.size() > 200)
+                    cmd = cmd.substr(0, 200) + "...";
+                out += std::string(2 * depth + 2, ' ') + std::to_string(p.pid) + " [" + p.state + "] wchan=" +
+                       (wchan.empty() || wchan == "0" ? "-" : wchan) + " " + (cmd.empty() ? "(" + p.comm + ")" : trim(cmd)) + "\n";
+
+                std::ifstream stack(base + "/stack");
+                std::string frame;
+                for (int i = 0; i < 8 && std::getline(stack, frame); ++i)
+                    out += std::string(2 * depth + 6, ' ') + frame + "\n";
+
+                for (const auto &child : job)
+                {
+                    if (child.ppid == p.pid)
+                        print(child, depth + 1);
+                }
+            };
+            for (const auto &p : job)
+            {
+                // Roots: the job leader and members whose parent is outside the job
+                if (p.pid == root || !members.count(p.ppid))
+                    print(p, 0);
+            }
+            return out;
+        }
+
+        /**
+         * @brief Total CPU ticks used so far by the job started as root.
+         */
+        static uint64_t jobCpuTicks(pid_t root)
+        {
+            uint64_t total = 0;
+            for (const auto &p : jobProcesses(root))
+                total += p.cpuTicks;
+            return total;
+        }
+
+        static volatile sig_atomic_t phaseInterruptSignal = 0;
+
+        extern "C" void onPhaseInterrupt(int sig) { phaseInterruptSignal = sig; }
+
+        /**
+         * @brief Supervises a running phase until it has exited: pumps its stdout and
+         *        stderr pipes (either may be -1) into log, enforces the phase timeout and
+         *        the hang watchdog, forwards Ctrl-C/SIGTERM to it, then reaps it.
+         *
+         * The phase must lead its own process group. When it times out, or shows neither
+         * CPU progress nor output for hangTimeout, its process tree is dumped and the
+         * whole group gets SIGTERM, then SIGKILL ten seconds later.
+         *
+         * The child is reaped and the limits are checked on every iteration, so a
+         * phase that keeps printing is still timed out and interrupted. Output still
+         * trickling in from daemons the child left behind does not keep the phase
+         * alive: once the child is gone we stop at the first idle poll, or a second
+         * after it exited.
+         */
+        static bool superviseProcess(pid_t pid, int outFd, int errFd, PhaseLog *log, PhaseContext &context)
+        {
+            using Clock = std::chrono::steady_clock;
+            ProcessResult &result = context.result;
+            struct pollfd fds[2] = {{outFd, POLLIN, 0}, {errFd, POLLIN, 0}};
+            const int streams[2] = {STDOUT_FILENO, STDERR_FILENO};
+            std::vector<char> buf(64 * 1024);
+            bool exited = false;
+
+            // The phase is in its own process group, so terminal signals no longer reach
+            // it directly; catch them here (interrupting poll) and pass them on.
+            struct sigaction action = {}, oldInt, oldTerm, oldHup;
+            action.sa_handler = onPhaseInterrupt;
+            sigemptyset(&action.sa_mask);
+            phaseInterruptSignal = 0;
+            ::sigaction(SIGINT, &action, &oldInt);
+            ::sigaction(SIGTERM, &action, &oldTerm);
+            ::sigaction(SIGHUP, &action, &oldHup);
+
+            const Clock::time_point start = Clock::now();
+            Clock::time_point lastProgress = start;
+            Clock::time_point nextCpuCheck = start;
+            Clock::time_point killDeadline;
+            uint64_t lastCpu = 0;
+            int killStage = 0; // 0 running, 1 SIGTERM sent, 2 SIGKILL sent
+
+            auto abortPhase = [&](const std::string &reason, const std::string &why)
+            {
+                context.abortReason = reason;
+                std::string dump = describeProcessTree(pid);
+                log_error(why + "; process tree:\n" + dump);
+                if (log)
+                {
+                    std::string note = "\n*** create-starpack: " + why + "\n" + dump;
+                    log->write(note.data(), note.size(), -1);
+                }
+                ::kill(-pid, SIGTERM);
+                killStage = 1;
+                killDeadline = Clock::now() + std::chrono::seconds(10);
+            };
+
+            Clock::time_point exitedAt;
+            while (!exited || fds[0].fd >= 0 || fds[1].fd >= 0)
+            {
+                int ready = ::poll(fds, 2, exited ? 0 : 250);
+                if (ready < 0 && errno != EINTR)
+                    break;
+                if (ready > 0)
+                {
+                    for (int i = 0; i < 2; ++i)
+                    {
+                        if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                            continue;
+                        ssize_t n = ::read(fds[i].fd, buf.data(), buf.size());
+                        if (n > 0)
+                        {
+                            if (log)
+                                log->write(buf.data(), static_cast<size_t>(n), streams[i]);
+                            lastProgress = Clock::now();
+                        }
+                        else if (n == 0 || errno != EINTR)
+                            fds[i].fd = -1;
+                    }
+                }
+                if (exited)
+                {
+                    // Drain what is already there, but not a leftover daemon's endless output
+                    if (ready <= 0 || Clock::now() - exitedAt > std::chrono::seconds(1))
+                        break;
+                    continue;
+                }
+
+                // Every iteration, busy or idle: reap, then check the limits
+                if (ready == 0 && log)
+                    log->flush();
+                pid_t r = ::wait4(pid, &result.status, WNOHANG, &result.usage);
+                if (r == pid || (r < 0 && errno != EINTR))
+                {
+                    exited = true;
+                    exitedAt = Clock::now();
+                    continue;
+                }
+
+                const Clock::time_point now = Clock::now();
+                if (killStage == 0 && phaseInterruptSignal)
+                {
+                    context.abortReason = "interrupted";
+                    ::kill(-pid, phaseInterruptSignal);
+                    killStage = 1;
+                    killDeadline = now + std::chrono::seconds(10);
+                }
+                if (killStage == 0 && context.timeout.count() > 0 && now - start > context.timeout)
+                {
+                    abortPhase("timeout", "Phase exceeded its timeout of " + std::to_string(context.timeout.count()) + "s");
+                }
+                if (killStage == 0 && context.hangTimeout.count() > 0 && now >= nextCpuCheck)
+                {
+                    uint64_t cpu = jobCpuTicks(pid);
+                    if (cpu != lastCpu)
+                    {
+                        lastCpu = cpu;
+                        lastProgress = now;
+                    }
+                    nextCpuCheck = now + std::min<std::chrono::seconds>(std::chrono::seconds(5), context.hangTimeout);
+                    if (now - lastProgress > context.hangTimeout)
+                    {
+                        abortPhase("hang", "Phase used no CPU and printed nothing for " +
+                                               std::to_string(context.hangTimeout.count()) + "s");
+                    }
+                }
+                if (killStage == 1 && now > killDeadline)
+                {
+                    ::kill(-pid, SIGKILL);
+                    killStage = 2;
+                }
+            }
+
+            ::sigaction(SIGINT, &oldInt, nullptr);
+            ::sigaction(SIGTERM, &oldTerm, nullptr);
+            ::sigaction(SIGHUP, &oldHup, nullptr);
+            return exited ? result.status != -1 : waitProcess(pid, result);
+        }
+
+        /**
+         * @class FakerootSession
+         * @brief One faked daemon shared by every build phase and the packaging step.
+         *
+         * Instead of prefixing each phase with "fakeroot" (one daemon per phase, with the
+         * faked ownership lost in between), start() launches faked once per build and
+         * wrap() attaches processes to it by setting FAKEROOTKEY and preloading
+         * libfakeroot, exactly like the fakeroot script does. The daemon loads and saves
+         * its database from a state file, so ownership survives resumed builds too.
+         *
+         * If faked or libfakeroot cannot be located, wrap() falls back to running each
+         * process through "fakeroot -i <state> -s <state>", which still shares state.
+         */
+        class FakerootSession
+        {
+        public:
+            ~FakerootSession() { stop(); }
+
+            /**
+             * @brief Starts the daemon, loading stateFile if it exists.
+             *
+             * @return True if a shared daemon is running afterwards.
+             */
+            bool start(const fs::path &stateFile)
+            {
+                stop();
+                stateFile_ = stateFile;
+
+                std::string faked;
+                if (!locate(faked, libDir_, libName_))
+                {
+                    log_warning("faked/libfakeroot not found; falling back to one fakeroot per phase.");
+                    return false;
+                }
+
+                ProcessSpec spec;
+                spec.argv = {faked};
+                spec.env = Environment::current();
+                spec.env.unset("FAKEROOTKEY");
+
+                int stateIn = -1;
+                std::error_code ec;
+                if (fs::exists(stateFile_, ec))
+                {
+                    stateIn = ::open(stateFile_.c_str(), O_RDONLY | O_CLOEXEC);
+                    if (stateIn >= 0)
+                    {
+                        spec.argv.push_back("--load");
+                        spec.fds.push_back({stateIn, 0});
+                    }
+                }
+                spec.argv.insert(spec.argv.end(), {"--save-file", stateFile_.string()});
+
+                int out[2];
+                if (::pipe2(out, O_CLOEXEC) != 0)
+                {
+                    if (stateIn >= 0)
+                        ::close(stateIn);
+                    return false;
+                }
+                spec.fds.push_back({out[1], 1});
+
+                std::string error;
+                pid_t pid = spawnProcess(spec, error);
+                ::close(out[1]);
+                if (stateIn >= 0)
+                    ::close(stateIn);
+
+                // faked prints "<key>:<pid>", forks the daemon and exits.
+                std::string reply;
+                char buf[128];
+                ssize_t n;
+                while ((n = ::read(out[0], buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR))
+                {
+                    if (n > 0)
+                        reply.append(buf, static_cast<size_t>(n));
+                }
+                ::close(out[0]);
+
+                ProcessResult result;
+                if (pid < 0 || !waitProcess(pid, result) || !result.succeeded())
+                {
+                    log_warning("Could not start faked" + (error.empty() ? "" : ": " + error) +
+                                "; falling back to one fakeroot per phase.");
+                    return false;
+                }
+
+                size_t colon = reply.find(':');
+                if (colon == std::string::npos)
+                {
+                    log_warning("Unexpected reply from faked: " + reply);
+                    return false;
+                }
+                key_ = trim(reply.substr(0, colon));
+                daemonPid_ = static_cast<pid_t>(std::atol(reply.c_str() + colon + 1));
+                if (key_.empty() || daemonPid_ <= 0)
+                {
+                    log_warning("Unexpected reply from faked: " + reply);
+                    daemonPid_ = -1;
+                    return false;
+                }
+                log_message("Started fakeroot session (faked pid " + std::to_string(daemonPid_) + ").");
+                return true;
+            }
+
+            /**
+             * @brief Stops the daemon, which writes its database to the state file.
+             */
+            void stop()
+            {
+                if (daemonPid_ <= 0)
+                    return;
+
+                // faked is not our child (it daemonizes), so poll until it is gone.
+                ::kill(daemonPid_, SIGTERM);
+                for (int i = 0; i < 100 && ::kill(daemonPid_, 0) == 0; ++i)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                daemonPid_ = -1;
+                key_.clear();
+            }
+
+            bool active() const { return daemonPid_ > 0; }
+
+            /**
+             * @brief Makes spec run under fake root: attaches it to the shared daemon,
+             *        or, without one, prefixes it with a stateful fakeroot invocation.
+             */
+            bool wrap(ProcessSpec &spec) const
+            {
+                if (active())
+                {
+                    spec.env.set("FAKEROOTKEY", key_);
+                    const char *ldPath = spec.env.get("LD_LIBRARY_PATH");
+                    spec.env.set("LD_LIBRARY_PATH", libDir_ + (ldPath && *ldPath ? ":" + std::string(ldPath) : ""));
+                    const char *preload = spec.env.get("LD_PRELOAD");
+                    spec.env.set("LD_PRELOAD", libName_ + (preload && *preload ? ":" + std::string(preload) : ""));
+                    return true;
+                }
+
+                std::string fakeroot = findInPath("fakeroot");
+                if (fakeroot.empty())
+                {
+                    log_error("fakeroot is enabled but was not found in PATH.");
+                    return false;
+                }
+                std::vector<std::string> prefix = {fakeroot};
+                std::error_code ec;
+                if (!stateFile_.empty())
+                {
+                    if (fs::exists(stateFile_, ec))
+                        prefix.insert(prefix.end(), {"-i", stateFile_.string()});
+                    prefix.insert(prefix.end(), {"-s", stateFile_.string()});
+                }
+                prefix.push_back("--");
+                spec.argv.insert(spec.argv.begin(), prefix.begin(), prefix.end());
+                return true;
+            }
+
+        private:
+            /**
+             * @brief Finds the SysV-IPC faked binary and the matching preload library.
+             */
+            static bool locate(std::string &faked, std::string &libDir, std::string &libName)
+            {
+                faked = findInPath("faked-sysv");
+                libName = "libfakeroot-sysv.so";
+                if (faked.empty())
+                {
+                    faked = findInPath("faked");
+                    libName = "libfakeroot.so";
+                }
+                if (faked.empty())
+                    return false;
+
+                static const char *const libDirs[] = {
+                    "/usr/lib/x86_64-linux-gnu/libfakeroot", "/usr/lib/aarch64-linux-gnu/libfakeroot",
+                    "/usr/lib64/libfakeroot", "/usr/lib/libfakeroot", "/usr/lib32/libfakeroot",
+                    "/usr/local/lib/libfakeroot"};
+                for (const char *dir : libDirs)
+                {
+                    for (const char *name : {libName.c_str(), "libfakeroot-0.so", "libfakeroot.so"})
+                    {
+                        if (::access((std::string(dir) + "/" + name).c_str(), R_OK) == 0)
+                        {
+                            libDir = dir;
+                            libName = name;
+                            return true;
+                        }
+                    }
+                }
+                return false;
+            }
+
+            fs::path stateFile_;
+            pid_t daemonPid_ = -1;
+            std::string key_;
+            std::string libDir_;
+            std::string libName_;
+        };
+
+        /**
+         * @brief The fakeroot session of the current build (see createPackage()).
+         */
+        static FakerootSession fakerootSession;
+
+        /**
+         * @brief Mount point of the unified (v2) cgroup hierarchy: /sys/fs/cgroup on
+         *        pure v2 systems, /sys/fs/cgroup/unified in systemd's hybrid layout.
+         */
+        static fs::path cgroup2Root()
+        {
+            static const fs::path root = []
+            {
+                std::ifstream in("/proc/self/mountinfo");
+                std::string line;
+                while (std::getline(in, line))
+                {
+                    // "... <mount point> <options> - <fstype> <source> <options>"
+                    size_t dash = line.find(" - ");
+                    if (dash == std::string::npos || line.compare(dash + 3, 8, "cgroup2 ") != 0)
+                        continue;
+                    std::stringstream ss(line.substr(0, dash));
+                    std::string field, mountPoint;
+                    for (int i = 0; i < 5 && ss >> field; ++i)
+                        mountPoint = field;
+                    return fs::path(mountPoint);
+                }
+                return fs::path("/sys/fs/cgroup");
+            }();
+            return root;
+        }
+
+        /**
+         * @brief Returns our cgroup path for a controller from /proc/self/cgroup.
+         *
+         * @param controller A cgroup v1 controller name ("cpu", "memory"), or "" for
+         *        the unified (v2) hierarchy.
+         * @return The path relative to the hierarchy root, or "" if not found.
+         */
+        static std::string ownCgroupPath(const std::string &controller)
+        {
+            std::ifstream in("/proc/self/cgroup");
+            std::string line;
+            while (std::getline(in, line))
+            {
+                // "<id>:<controllers>:<path>"
+                size_t c1 = line.find(':');
+                size_t c2 = line.find(':', c1 + 1);
+                if (c1 == std::string::npos || c2 == std::string::npos)
+                    continue;
+                std::string controllers = line.substr(c1 + 1, c2 - c1 - 1);
+                std::string path = line.substr(c2 + 1);
+                if (controller.empty())
+                {
+                    if (line.compare(0, 3, "0::") == 0)
+                        return path;
+                    continue;
+                }
+                std::stringstream ss(controllers);
+                std::string name;
+                while (std::getline(ss, name, ','))
+                {
+                    if (name == controller)
+                        return path;
+                }
+            }
+            return "";
+        }
+
+        /**
+         * @brief CPU limit imposed by our cgroup (cpu.max, or cfs quota on v1), walking
+         *        up the hierarchy and taking the tightest limit.
+         *
+         * @return The limit rounded up to whole CPUs, or 0 if unlimited.
+         */
+        static unsigned cgroupCpuLimit()
+        {
+            unsigned limit = 0;
+            auto consider = [&](double quota, double period)
+            {
+                if (quota <= 0 || period <= 0)
+                    return;
+                unsigned cpus = std::max(1u, static_cast<unsigned>(std::ceil(quota / period)));
+                limit = limit == 0 ? cpus : std::min(limit, cpus);
+            };
+
+            std::string v2 = ownCgroupPath("");
+            const fs::path v2Root = cgroup2Root();
+            for (fs::path p = v2Root / fs::path(v2).relative_path();; p = p.parent_path())
+            {
+                std::stringstream ss(readFirstLine((p / "cpu.max").string()));
+                std::string quota, period;
+                if (ss >> quota >> period && quota != "max")
+                    consider(std::atof(quota.c_str()), std::atof(period.c_str()));
+                if (p == v2Root || p == p.parent_path())
+                    break;
+            }
+
+            std::string v1 = ownCgroupPath("cpu");
+            fs::path cpuRoot = fs::exists("/sys/fs/cgroup/cpu,cpuacct") ? "/sys/fs/cgroup/cpu,cpuacct" : "/sys/fs/cgroup/cpu";
+            for (fs::path p = cpuRoot / fs::path(v1).relative_path();; p = p.parent_path())
+            {
+                std::string quota = readFirstLine((p / "cpu.cfs_quota_us").string());
+                std::string period = readFirstLine((p / "cpu.cfs_period_us").string());
+                if (!quota.empty() && !period.empty())
+                    consider(std::atof(quota.c_str()), std::atof(period.c_str()));
+                if (p == cpuRoot || p == p.parent_path())
+                    break;
+            }
+            return limit;
+        }
+
+        /**
+         * @brief Memory available for the build: MemAvailable from /proc/meminfo, capped
+         *        by our cgroup's memory limit (v2 memory.max or v1 limit_in_bytes).
+         */
+        static uint64_t availableMemoryBytes()
+        {
+            uint64_t available = 0;
+            std::ifstream meminfo("/proc/meminfo");
+            std::string key;
+            uint64_t kb;
+            std::string unit;
+            while (meminfo >> key >> kb >> unit)
+            {
+                if (key == "MemAvailable:")
+                {
+                    available = kb * 1024;
+                    break;
+                }
+            }
+
+            auto cap = [&](const std::string &file)
+            {
+                std::string value = readFirstLine(file);
+                if (value.empty() || value == "max")
+                    return;
+                uint64_t limit = std::strtoull(value.c_str(), nullptr, 10);
+                // v1 reports "unlimited" as a huge page-aligned number
+                if (limit > 0 && limit < (uint64_t(1) << 60))
+                    available = available == 0 ? limit : std::min(available, limit);
+            };
+            std::string v2 = ownCgroupPath("");
+            if (!v2.empty() && v2 != "/")
+                cap((cgroup2Root() / fs::path(v2).relative_path() / "memory.max").string());
+            std::string v1 = ownCgroupPath("memory");
+            if (!v1.empty())
+                cap("/sys/fs/cgroup/memory" + v1 + "/memory.limit_in_bytes");
+            return available;
+        }
+
+        /**
+         * @brief Works out how many parallel jobs build scripts should use.
+         *
+         * Takes the CPUs we may run on (affinity mask), limits that by the cgroup CPU
+         * quota and by available memory divided by memoryPerJobMiB. --jobs overrides
+         * the result.
+         */
+        static unsigned computeBuildJobs()
+        {
+            if (jobsOverride > 0)
+            {
+                log_message("Using " + std::to_string(jobsOverride) + " parallel jobs (--jobs).");
+                return jobsOverride;
+            }
+
+            cpu_set_t set;
+            unsigned cores = 0;
+            if (sched_getaffinity(0, sizeof(set), &set) == 0)
+                cores = static_cast<unsigned>(CPU_COUNT(&set));
+            if (cores == 0)
+                cores = std::max(1u, std::thread::hardware_concurrency());
+
+            unsigned jobs = cores;
+            std::string why = std::to_string(cores) + " CPUs";
+
+            unsigned quota = cgroupCpuLimit();
+            if (quota > 0)
+            {
+                why += ", cgroup quota " + std::to_string(quota);
+                jobs = std::min(jobs, quota);
+            }
+
+            uint64_t mem = availableMemoryBytes();
+            if (mem > 0 && memoryPerJobMiB > 0)
+            {
+                unsigned byMemory = static_cast<unsigned>(
+                    std::max<uint64_t>(1, mem / (uint64_t(memoryPerJobMiB) * 1024 * 1024)));
+                why += ", " + std::to_string(mem / (1024 * 1024)) + " MiB available";
+                jobs = std::min(jobs, byMemory);
+            }
+
+            jobs = std::max(1u, jobs);
+            log_message("Using " + std::to_string(jobs) + " parallel jobs (" + why + ").");
+            return jobs;
+        }
+
+        /**
+         * @brief Job count for the current build, set by createPackage().
+         */
+        static unsigned buildJobs = 1;
+
+        /**
+         * @brief Exports the job count in the forms common build tools understand.
+         *
+         * A -j already present in MAKEFLAGS is left alone. Under a jobserver the counts
+         * for ninja, cmake --build and cargo are not exported: those tools would run
+         * that many jobs beside the pool, while without them they take their slots from
+         * the jobserver advertised in MAKEFLAGS/CARGO_MAKEFLAGS.
+         */
+        static void exportBuildJobs(Environment &env, unsigned jobs, bool underJobserver = false)
+        {
+            std::string n = std::to_string(jobs);
+            env.set("jobs", n);
+
+            const char *makeflags = env.get("MAKEFLAGS");
+            std::string flags = makeflags ? makeflags : "";
+            if (flags.find("-j") == std::string::npos)
+                env.set("MAKEFLAGS", trim("-j" + n + " " + flags));
+
+            if (!underJobserver)
+            {
+                env.set("NINJAJOBS", n);
+                env.set("CMAKE_BUILD_PARALLEL_LEVEL", n);
+                env.set("CARGO_BUILD_JOBS", n);
+            }
+            env.set("CTEST_PARALLEL_LEVEL", n);
+            env.set("MESON_TESTTHREADS", n);
+            env.set("GOFLAGS", trim("-p=" + n + " " + std::string(env.get("GOFLAGS") ? env.get("GOFLAGS") : "")));
+        }
+
+        /**
+         * @brief Runs a command to completion and collects its stdout.
+         */
+        static bool captureCommandOutput(ProcessSpec spec, std::string &output)
+        {
+            int fds[2];
+            if (::pipe2(fds, O_CLOEXEC) != 0)
+                return false;
+            spec.fds.push_back({fds[1], STDOUT_FILENO});
+            std::string error;
+            pid_t pid = spawnProcess(spec, error);
+            ::close(fds[1]);
+            if (pid < 0)
+            {
+                ::close(fds[0]);
+                return false;
+            }
+            char buf[4096];
+            ssize_t n;
+            while ((n = ::read(fds[0], buf, sizeof(buf))) != 0)
+            {
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0)
+                    break;
+                output.append(buf, static_cast<size_t>(n));
+            }
+            ::close(fds[0]);
+            ProcessResult result;
+            return waitProcess(pid, result) && result.succeeded();
+        }
+
+        /**
+         * @struct CompilerCacheStats
+         * Cache hits and misses of one build, for the build report.
+         */
+        struct CompilerCacheStats
+        {
+            bool ccache = false;
+            uint64_t ccacheHits = 0;
+            uint64_t ccacheMisses = 0;
+            bool sccache = false;
+            uint64_t sccacheHits = 0;
+            uint64_t sccacheMisses = 0;
+        };
+
+        /**
+         * @brief Per-user cache directory: $XDG_CACHE_HOME/create-starpack or
+         *        ~/.cache/create-starpack.
+         */
+        static fs::path defaultCacheRoot()
+        {
+            const char *xdg = getenv("XDG_CACHE_HOME");
+            const char *home = getenv("HOME");
+            return xdg && *xdg ? fs::path(xdg) / "create-starpack"
+                               : fs::path(home ? home : "/tmp") / ".cache" / "create-starpack";
+        }
+
+        /**
+         * @class CompilerCache
+         * @brief Puts ccache in front of C/C++ compilers and sccache in front of rustc
+         *        for every build phase.
+         *
+         * Each package gets its own cache directory (<root>/ccache/<package>,
+         * <root>/sccache/<package>) limited to compilerCacheSize. ccache is reached
+         * through a directory of symlinks named after the installed compilers, prepended
+         * to PATH (masquerade mode), with CCACHE_BASEDIR set to the STARBUILD directory so hits survive
+         * building from a different path. sccache runs its own server on a private port
+         * so its statistics belong to this build only.
+         */
+        class CompilerCache
+        {
+        public:
+            bool active() const { return !ccache_.empty() || !sccache_.empty(); }
+
+            bool setup(const std::string &package, const fs::path &srcdir)
+            {
+                fs::path root = compilerCacheDir.empty() ? defaultCacheRoot() : fs::path(compilerCacheDir);
+                std::error_code ec;
+                basedir_ = fs::weakly_canonical(srcdir, ec).string(); // ccache wants a clean absolute path
+
+                ccache_ = findInPath("ccache");
+                if (!ccache_.empty())
+                {
+                    ccacheDir_ = root / "ccache" / package;
+                    wrapperDir_ = root / "bin";
+                    fs::create_directories(ccacheDir_, ec);
+                    fs::create_directories(wrapperDir_, ec);
+                    // Only installed compilers get a wrapper: a dangling "clang" would make
+                    // configure scripts pick a compiler ccache cannot find. The directory is
+                    // shared with concurrent builds, so links are swapped in with rename().
+                    for (const char *compiler : {"cc", "gcc", "c++", "g++", "clang", "clang++"})
+                    {
+                        fs::path link = wrapperDir_ / compiler;
+                        if (findInPath(compiler, wrapperDir_).empty())
+                        {
+                            fs::remove(link, ec);
+                            continue;
+                        }
+                        if (fs::is_symlink(link, ec) && fs::read_symlink(link, ec) == ccache_)
+                            continue;
+                        fs::path tmp = wrapperDir_ / ("." + std::string(compiler) + "." + std::to_string(getpid()));
+                        fs::remove(tmp, ec);
+                        if (::symlink(ccache_.c_str(), tmp.c_str()) != 0 || ::rename(tmp.c_str(), link.c_str()) != 0)
+                        {
+                            log_warning("Could not create ccache wrapper " + link.string() + ": " + strerror(errno));
+                            fs::remove(tmp, ec);
+                        }
+                    }
+                    runTool(ccache_, {"--zero-stats"});
+                }
+
+                sccache_ = findInPath("sccache");
+                if (!sccache_.empty())
+                {
+                    sccacheDir_ = root / "sccache" / package;
+                    fs::create_directories(sccacheDir_, ec);
+                    port_ = freeLocalPort();
+                    if (port_ == 0)
+                        sccache_.clear();
+                }
+
+                if (!active())
+                {
+                    log_warning("--ccache given, but neither ccache nor sccache is installed.");
+                    return false;
+                }
+                log_message("Compiler cache for " + package + ": " +
+                            (ccache_.empty() ? "" : "ccache in " + ccacheDir_.string()) +
+                            (!ccache_.empty() && !sccache_.empty() ? ", " : "") +
+                            (sccache_.empty() ? "" : "sccache in " + sccacheDir_.string()) +
+                            " (max " + compilerCacheSize + ")");
+                return true;
+            }
+
+            void apply(Environment &env) const
+            {
+                if (!ccache_.empty())
+                {
+                    const char *path = env.get("PATH");
+                    env.set("PATH", wrapperDir_.string() + (path ? ":" + std::string(path) : ""));
+                    env.set("CCACHE_DIR", ccacheDir_.string());
+                    env.set("CCACHE_MAXSIZE", compilerCacheSize);
+                    env.set("CCACHE_BASEDIR", basedir_);
+                    env.set("CCACHE_NOHASHDIR", "true");
+                }
+                if (!sccache_.empty())
+                {
+                    env.set("RUSTC_WRAPPER", sccache_);
+                    env.set("SCCACHE_DIR", sccacheDir_.string());
+                    env.set("SCCACHE_CACHE_SIZE", compilerCacheSize);
+                    env.set("SCCACHE_SERVER_PORT", std::to_string(port_));
+                }
+            }
+
+            /**
+             * @brief Collects hit/miss counts and stops the sccache server.
+             */
+            CompilerCacheStats finish()
+            {
+                CompilerCacheStats stats;
+                std::string out;
+                if (!ccache_.empty() && runTool(ccache_, {"--print-stats"}, &out))
+                {
+                    // "key<TAB>value" lines; key names differ between ccache 3.7 and 4.x
+                    std::stringstream ss(out);
+                    std::string key;
+                    uint64_t value;
+                    while (ss >> key >> value)
+                    {
+                        if (key == "direct_cache_hit" || key == "preprocessed_cache_hit" ||
+                            key == "cache_hit_direct" || key == "cache_hit_preprocessed")
+                            stats.ccacheHits += value;
+                        else if (key == "cache_miss")
+                            stats.ccacheMisses += value;
+                    }
+                    stats.ccache = true;
+                }
+                out.clear();
+                if (!sccache_.empty() && runTool(sccache_, {"--show-stats", "--stats-format=json"}, &out))
+                {
+                    try
+                    {
+                        // JSON is valid YAML
+                        YAML::Node node = YAML::Load(out)["stats"];
+                        auto sum = [](const YAML::Node &counts)
+                        {
+                            uint64_t total = 0;
+                            for (const auto &kv : counts)
+                                total += kv.second.as<uint64_t>();
+                            return total;
+                        };
+                        stats.sccacheHits = sum(node["cache_hits"]["counts"]);
+                        stats.sccacheMisses = sum(node["cache_misses"]["counts"]);
+                        stats.sccache = true;
+                    }
+                    catch (const std::exception &ex)
+                    {
+                        log_warning(std::string("Could not read sccache statistics: ") + ex.what());
+                    }
+                }
+                if (!sccache_.empty())
+                    runTool(sccache_, {"--stop-server"});
+                if (stats.ccache)
+                    log_message("ccache: " + std::to_string(stats.ccacheHits) + " hits, " +
+                                std::to_string(stats.ccacheMisses) + " misses");
+                if (stats.sccache)
+                    log_message("sccache: " + std::to_string(stats.sccacheHits) + " hits, " +
+                                std::to_string(stats.sccacheMisses) + " misses");
+                ccache_.clear();
+                sccache_.clear();
+                return stats;
+            }
+
+        private:
+            bool runTool(const std::string &tool, std::vector<std::string> args, std::string *output = nullptr) const
+            {
+                ProcessSpec spec;
+                spec.env = Environment::current();
+                apply(spec.env);
+                spec.argv = {tool};
+                spec.argv.insert(spec.argv.end(), args.begin(), args.end());
+                int nullFd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+                if (nullFd >= 0)
+                    spec.fds.push_back({nullFd, output ? STDERR_FILENO : STDOUT_FILENO});
+                std::string discard;
+                bool ok = captureCommandOutput(spec, output ? *output : discard);
+                if (nullFd >= 0)
+                    ::close(nullFd);
+                return ok;
+            }
+
+            /**
+             * @brief Asks the kernel for an unused loopback TCP port.
+             */
+            static unsigned freeLocalPort()
+            {
+                int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                if (fd < 0)
+                    return 0;
+                sockaddr_in addr = {};
+                addr.sin_family = AF_INET;
+                addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                socklen_t len = sizeof(addr);
+                unsigned port = 0;
+                if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0 &&
+                    ::getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) == 0)
+                    port = ntohs(addr.sin_port);
+                ::close(fd);
+                return port;
+            }
+
+            std::string ccache_;
+            std::string sccache_;
+            fs::path ccacheDir_;
+            fs::path sccacheDir_;
+            fs::path wrapperDir_;
+            std::string basedir_;
+            unsigned port_ = 0;
+        };
+
+        /**
+         * @brief Compiler cache of the current build (see createPackage()).
+         */
+        static CompilerCache compilerCache;
+
+        /**
+         * @class TmpfsWorkDir
+         * @brief Keeps the build tree (extracted sources, build output and packages/)
+         *        in memory for --tmpfs-build.
+         *
+         * As root the tree lives on a private tmpfs mounted at
+         * <starbuild>/.starpack-tmpfs, otherwise in a fresh directory under /dev/shm.
+         * The space needed is estimated from the package's peak usage in earlier
+         * builds (tmpfs-history.yaml in the cache root) or, without history, from the
+         * size of its sources. If that does not fit into half of the available memory
+         * the build stays on disk. The .starpack files, logs and report are written to
+         * the STARBUILD directory directly, so nothing is copied back afterwards.
+         */
+        class TmpfsWorkDir
+        {
+        public:
+            bool active() const { return !path_.empty(); }
+            const fs::path &path() const { return path_; }
+
+            /**
+             * @brief Sets up the in-memory tree, or logs why the build stays on disk.
+             * @return True if the build tree is in memory.
+             */
+            bool setup(const std::string &package, const fs::path &starbuildDir,
+                       const std::vector<std::string> &sources)
+            {
+                package_ = package;
+                peak_ = 0;
+                historyPath_ = defaultCacheRoot() / "tmpfs-history.yaml";
+
+                // Sources not downloaded yet count as nothing; the floor covers small ones
+                uint64_t previousPeak = readHistory();
+                uint64_t needed = previousPeak > 0 ? previousPeak + previousPeak / 4
+                                                   : presentSourceBytes(starbuildDir, sources) * kSourceExpansion;
+                needed = std::max(kMinimumBytes, needed);
+
+                uint64_t budget = availableMemoryBytes() / 2;
+                if (budget == 0 || needed > budget)
+                {
+                    log_message("--tmpfs-build: the build needs about " + toMiB(needed) + ", but only " +
+                                toMiB(budget) + " of memory can be spared; building on disk.");
+                    return false;
+                }
+
+                if (geteuid() == 0 && mountPrivate(starbuildDir / ".starpack-tmpfs", budget))
+                {
+                    log_message("Building in a private tmpfs at " + path_.string() + " (estimated " +
+                                toMiB(needed) + ", limit " + toMiB(budget) + ").");
+                    return true;
+                }
+
+                struct statfs fsInfo;
+                struct statvfs vfsInfo;
+                if (::statfs("/dev/shm", &fsInfo) != 0 || fsInfo.f_type != TMPFS_MAGIC ||
+                    ::statvfs("/dev/shm", &vfsInfo) != 0)
+                {
+                    log_message("--tmpfs-build: /dev/shm is not a tmpfs; building on disk.");
+                    return false;
+                }
+                uint64_t shmFree = uint64_t(vfsInfo.f_bavail) * vfsInfo.f_frsize;
+                if (needed > shmFree)
+                {
+                    log_message("--tmpfs-build: /dev/shm has only " + toMiB(shmFree) + " free, the build needs about " +
+                                toMiB(needed) + "; building on disk.");
+                    return false;
+                }
+                char templ[] = "/dev/shm/create-starpack.XXXXXX";
+                if (!::mkdtemp(templ))
+                {
+                    log_warning(std::string("--tmpfs-build: cannot create a directory in /dev/shm: ") + strerror(errno));
+                    return false;
+                }
+                path_ = templ;
+                log_message("Building in " + path_.string() + " (estimated " + toMiB(needed) + ").");
+                return true;
+            }
+
+            /**
+             * @brief Updates the peak usage; called after every phase.
+             *
+             * statvfs() on our own mount is exact and cheap. A /dev/shm directory is
+             * shared with others, so there the tree itself is measured.
+             */
+            void sample()
+            {
+                if (!active())
+                    return;
+                uint64_t used = 0;
+                struct statvfs info;
+                if (mounted_ && ::statvfs(path_.c_str(), &info) == 0)
+                {
+                    used = uint64_t(info.f_blocks - info.f_bfree) * info.f_frsize;
+                }
+                else
+                {
+                    std::error_code ec;
+                    for (auto it = fs::recursive_directory_iterator(path_, fs::directory_options::skip_permission_denied, ec);
+                         !ec && it != fs::recursive_directory_iterator(); it.increment(ec))
+                    {
+                        struct stat st;
+                        if (::lstat(it->path().c_str(), &st) == 0)
+                            used += uint64_t(st.st_blocks) * 512;
+                    }
+                }
+                peak_ = std::max(peak_, used);
+            }
+
+            /**
+             * @brief Records the peak usage for the next build and removes the tree.
+             *
+             * A failed build may not have reached its peak, so its usage only ever
+             * raises the recorded value.
+             */
+            void finish(bool succeeded)
+            {
+                if (!active())
+                    return;
+                sample();
+                uint64_t previousPeak = readHistory();
+                writeHistory(succeeded ? peak_ : std::max(peak_, previousPeak));
+                log_message("Build tree peaked at " + toMiB(peak_) + " in memory.");
+
+                std::error_code ec;
+                if (mounted_)
+                {
+                    // Lazy unmount: the memory is freed once nothing uses the tree
+                    if (::umount2(path_.c_str(), MNT_DETACH) != 0)
+                        log_warning("Could not unmount " + path_.string() + ": " + strerror(errno));
+                    fs::remove(path_, ec);
+                }
+                else
+                {
+                    fs::remove_all(path_, ec);
+                    if (ec)
+                    {
+                        // Builds like to leave read-only directories behind
+                        for (auto it = fs::recursive_directory_iterator(path_, fs::directory_options::skip_permission_denied, ec);
+                             !ec && it != fs::recursive_directory_iterator(); it.increment(ec))
+                        {
+                            std::error_code permEc;
+                            if (it->is_directory(permEc) && !it->is_symlink(permEc))
+                                fs::permissions(it->path(), fs::perms::owner_all, fs::perm_options::add, permEc);
+                        }
+                        fs::remove_all(path_, ec);
+                    }
+                    if (ec)
+                        log_warning("Could not remove " + path_.string() + ": " + ec.message());
+                }
+                path_.clear();
+                mounted_ = false;
+            }
+
+        private:
+            static constexpr uint64_t kMinimumBytes = 512ull * 1024 * 1024;
+            static constexpr uint64_t kSourceExpansion = 10; ///< Build tree size per byte of (compressed) source
+
+            static std::string toMiB(uint64_t bytes)
+            {
+                return std::to_string(bytes / (1024 * 1024)) + " MiB";
+            }
+
+            /**
+             * @brief Size of the sources already on disk (earlier downloads, local files).
+             */
+            static uint64_t presentSourceBytes(const fs::path &starbuildDir, const std::vector<std::string> &sources)
+            {
+                uint64_t total = 0;
+                for (const auto &src : sources)
+                {
+                    if (src.rfind("git+", 0) == 0)
+                        continue;
+                    fs::path file;
+                    size_t doubleColon = src.find("::");
+                    if (doubleColon != std::string::npos)
+                        file = src.substr(0, doubleColon);
+                    else if (src.find("://") != std::string::npos)
+                        file = fs::path(src).filename();
+                    else
+                        file = starbuildDir / src;
+                    std::error_code ec;
+                    uintmax_t size = fs::file_size(file, ec);
+                    if (!ec)
+                        total += size;
+                }
+                return total;
+            }
+
+            bool mountPrivate(const fs::path &mountPoint, uint64_t size)
+            {
+                std::error_code ec;
+                // Left behind by a build that was killed
+                ::umount2(mountPoint.c_str(), MNT_DETACH);
+                fs::remove_all(mountPoint, ec);
+                if (!fs::create_directory(mountPoint, ec))
+                    return false;
+                std::string options = "size=" + std::to_string(size) + ",mode=0755";
+                if (::mount("tmpfs", mountPoint.c_str(), "tmpfs", MS_NOSUID | MS_NODEV, options.c_str()) != 0)
+                {
+                    log_warning("--tmpfs-build: cannot mount a tmpfs at " + mountPoint.string() + ": " + strerror(errno));
+                    fs::remove(mountPoint, ec);
+                    return false;
+                }
+                // Keep mounts made inside the tree from propagating anywhere else
+                ::mount(nullptr, mountPoint.c_str(), nullptr, MS_PRIVATE, nullptr);
+                path_ = mountPoint;
+                mounted_ = true;
+                return true;
+            }
+
+            uint64_t readHistory() const
+            {
+                try
+                {
+                    YAML::Node history = YAML::LoadFile(historyPath_.string());
+                    if (history[package_])
+                        return history[package_].as<uint64_t>();
+                }
+                catch (const std::exception &)
+                {
+                    // No history yet
+                }
+                return 0;
+            }
+
+            void writeHistory(uint64_t peak) const
+            {
+                YAML::Node history;
+                try
+                {
+                    history = YAML::LoadFile(historyPath_.string());
+                }
+                catch (const std::exception &)
+                {
+                }
+                if (!history.IsMap())
+                    history = YAML::Node(YAML::NodeType::Map);
+                history[package_] = peak;
+
+                YAML::Emitter emitter;
+                emitter << history;
+                std::error_code ec;
+                fs::create_directories(historyPath_.parent_path(), ec);
+                fs::path tmp = historyPath_.string() + ".tmp." + std::to_string(getpid());
+                {
+                    std::ofstream out(tmp, std::ios::trunc);
+                    out << emitter.c_str() << "\n";
+                    if (!out)
+                    {
+                        fs::remove(tmp, ec);
+                        return;
+                    }
+                }
+                fs::rename(tmp, historyPath_, ec);
+            }
+
+            std::string package_;
+            fs::path path_;
+            fs::path historyPath_;
+            bool mounted_ = false;
+            uint64_t peak_ = 0;
+        };
+
+        /**
+         * @brief In-memory build tree of the current build (see createPackage()).
+         */
+        static TmpfsWorkDir tmpfsWorkDir;
+
+        /**
+         * @brief Whether $CC (default cc) is clang. Clang and GCC disagree on some
+         *        optimization flags (-flto=thin, profile options).
+         */
+        static bool compilerIsClang()
+        {
+            static const bool clang = []
+            {
+                const char *cc = getenv("CC");
+                std::string compiler = cc && *cc ? cc : "cc";
+                compiler = compiler.substr(0, compiler.find(' '));
+                if (compiler.find('/') == std::string::npos)
+                    compiler = findInPath(compiler);
+                if (compiler.empty())
+                    return false;
+                ProcessSpec spec;
+                spec.env = Environment::current();
+                spec.argv = {compiler, "--version"};
+                std::string out;
+                return captureCommandOutput(spec, out) && out.find("clang") != std::string::npos;
+            }();
+            return clang;
+        }
+
+        /**
+         * @class BuildProfile
+         * @brief Compiler and linker settings exported to every build phase.
+         *
+         * Profiles are read from buildConfigFile (/etc/create-starpack.conf), a YAML
+         * file such as
+         *
+         *     default_profile: native
+         *     profiles:
+         *       native:
+         *         cflags: "-O2 -pipe"
+         *         cxxflags: "-O2 -pipe"   # defaults to cflags
+         *         ldflags: "-Wl,-O1 -Wl,--as-needed"
+         *         rustflags: "-C opt-level=3"
+         *         march: native           # -march= and -C target-cpu=
+         *         lto: thin               # thin, full or none
+         *         linker: mold            # mold, lld or default
+         *
+         * on top of the built-in "release", "debug" and "none" profiles, which a
+         * profile of the same name replaces. The profile used is --build-profile,
+         * else the STARBUILD's build_profile, else the file's default_profile, else
+         * "release". march, lto and linker are turned into the flags the detected C
+         * compiler and rustc understand; Cargo gets LTO through
+         * CARGO_PROFILE_RELEASE_LTO, since -C lto in RUSTFLAGS breaks proc-macro crates.
+         * Flags already in our environment are appended to the profile's.
+         */
+        class BuildProfile
+        {
+        public:
+            bool active() const { return !name_.empty() && name_ != "none"; }
+
+            /**
+             * @brief Loads the configuration and resolves the profile to build with.
+             * @param recipeProfile The STARBUILD's build_profile, or empty.
+             * @return False if the configuration is invalid or the profile unknown.
+             */
+            bool select(const std::string &recipeProfile)
+            {
+                *this = BuildProfile();
+                std::map<std::string, Settings> profiles = builtinProfiles();
+                std::string configDefault;
+                std::error_code ec;
+                if (!buildConfigFile.empty() && fs::exists(buildConfigFile, ec))
+                {
+                    try
+                    {
+                        YAML::Node config = YAML::LoadFile(buildConfigFile);
+                        if (config["default_profile"])
+                            configDefault = config["default_profile"].as<std::string>();
+                        for (const auto &entry : config["profiles"])
+                        {
+                            Settings settings;
+                            const YAML::Node &node = entry.second;
+                            auto get = [&](const char *key, std::string &out)
+                            {
+                                if (node[key])
+                                    out = node[key].as<std::string>();
+                            };
+                            get("cflags", settings.cflags);
+                            settings.cxxflags = settings.cflags;
+                            get("cxxflags", settings.cxxflags);
+                            get("ldflags", settings.ldflags);
+                            get("rustflags", settings.rustflags);
+                            get("march", settings.march);
+                            get("lto", settings.lto);
+                            get("linker", settings.linker);
+                            profiles[entry.first.as<std::string>()] = settings;
+                        }
+                    }
+                    catch (const std::exception &ex)
+                    {
+                        log_error("Invalid build configuration " + buildConfigFile + ": " + ex.what());
+                        return false;
+                    }
+                }
+
+                std::string name = !buildProfileName.empty() ? buildProfileName
+                                   : !recipeProfile.empty()  ? recipeProfile
+                                   : !configDefault.empty()  ? configDefault
+                                                             : "release";
+                auto it = profiles.find(name);
+                if (it == profiles.end())
+                {
+                    log_error("Unknown build profile '" + name + "' (not built in and not defined in " +
+                              buildConfigFile + ").");
+                    return false;
+                }
+                name_ = name;
+                settings_ = it->second;
+                if (!resolve())
+                    return false;
+                if (active())
+                    inheritEnvironmentFlags();
+                if (active())
+                    log_message("Build profile " + name_ + ": CFLAGS=\"" + cflags_ + "\" LDFLAGS=\"" + ldflags_ + "\"" +
+                                (rustflags_.empty() ? "" : " RUSTFLAGS=\"" + rustflags_ + "\""));
+                return true;
+            }
+
+            void apply(Environment &env) const
+            {
+                if (!active())
+                    return;
+                env.set("STARPACK_BUILD_PROFILE", name_);
+                env.set("CFLAGS", cflags_);
+                env.set("CXXFLAGS", cxxflags_);
+                env.set("LDFLAGS", ldflags_);
+                if (!rustflags_.empty())
+                    env.set("RUSTFLAGS", rustflags_);
+                if (!cargoLto_.empty())
+                    env.set("CARGO_PROFILE_RELEASE_LTO", cargoLto_);
+            }
+
+            /**
+             * @brief The profile and the flags it produced, for metadata.yaml.
+             */
+            YAML::Node describe() const
+            {
+                YAML::Node node;
+                node["name"] = name_;
+                node["cflags"] = cflags_;
+                node["cxxflags"] = cxxflags_;
+                node["ldflags"] = ldflags_;
+                if (!rustflags_.empty())
+                    node["rustflags"] = rustflags_;
+                if (!settings_.march.empty())
+                    node["march"] = settings_.march;
+                node["lto"] = settings_.lto.empty() ? "none" : settings_.lto;
+                node["linker"] = linker_.empty() ? "default" : linker_;
+                return node;
+            }
+
+        private:
+            struct Settings
+            {
+                std::string cflags;
+                std::string cxxflags;
+                std::string ldflags;
+                std::string rustflags;
+                std::string march;
+                std::string lto;
+                std::string linker;
+            };
+
+            /**
+             * @brief Appends CFLAGS, CXXFLAGS, LDFLAGS and RUSTFLAGS from our own
+             *        environment to the profile's, so cross and custom-toolchain settings
+             *        survive and, coming last, win over the profile where they conflict.
+             */
+            void inheritEnvironmentFlags()
+            {
+                std::vector<std::string> kept;
+                auto inherit = [&](const char *key, std::string &flags)
+                {
+                    const char *value = getenv(key);
+                    if (!value || trim(value).empty())
+                        return;
+                    flags = trim(flags + " " + value);
+                    kept.push_back(key);
+                };
+                inherit("CFLAGS", cflags_);
+                inherit("CXXFLAGS", cxxflags_);
+                inherit("LDFLAGS", ldflags_);
+                inherit("RUSTFLAGS", rustflags_);
+                if (!kept.empty())
+                {
+                    std::string names;
+                    for (const auto &key : kept)
+                        names += (names.empty() ? "" : ", ") + key;
+                    log_warning("Build profile " + name_ + ": appending " + names +
+                                " from the environment to the profile's flags.");
+                }
+            }
+
+            static std::map<std::string, Settings> builtinProfiles()
+            {
+                Settings release;
+                release.cflags = release.cxxflags = "-O2 -pipe -fstack-protector-strong -fstack-clash-protection";
+                release.ldflags = "-Wl,-O1 -Wl,--as-needed -Wl,-z,relro -Wl,-z,now";
+                Settings debug;
+                debug.cflags = debug.cxxflags = "-O0 -g -pipe";
+                debug.rustflags = "-C debuginfo=2";
+                return {{"release", release}, {"debug", debug}, {"none", Settings()}};
+            }
+
+            /**
+             * @brief Folds march, lto and linker into the exported flags.
+             */
+            bool resolve()
+            {
+                cflags_ = settings_.cflags;
+                cxxflags_ = settings_.cxxflags;
+                ldflags_ = settings_.ldflags;
+                rustflags_ = settings_.rustflags;
+                auto add = [](std::string &flags, const std::string &flag)
+                {
+                    flags = trim(flags + " " + flag);
+                };
+
+                if (!settings_.march.empty())
+                {
+                    add(cflags_, "-march=" + settings_.march);
+                    add(cxxflags_, "-march=" + settings_.march);
+                    add(rustflags_, "-C target-cpu=" + settings_.march);
+                }
+
+                const std::string &lto = settings_.lto;
+                if (lto == "thin" || lto == "full")
+                {
+                    // GCC has no ThinLTO; its parallel WHOPR mode is the closest match
+                    std::string flag = !compilerIsClang() ? "-flto=auto" : lto == "thin" ? "-flto=thin" : "-flto";
+                    add(cflags_, flag);
+                    add(cxxflags_, flag);
+                    add(ldflags_, flag);
+                    cargoLto_ = lto == "thin" ? "thin" : "fat";
+                }
+                else if (!lto.empty() && lto != "none")
+                {
+                    log_error("Build profile " + name_ + ": lto must be thin, full or none, not '" + lto + "'.");
+                    return false;
+                }
+
+                const std::string &linker = settings_.linker;
+                if (linker == "mold" || linker == "lld")
+                {
+                    if (findInPath(linker == "mold" ? "mold" : "ld.lld").empty())
+                    {
+                        log_warning("Build profile " + name_ + " asks for " + linker +
+                                    ", which is not installed; using the default linker.");
+                    }
+                    else
+                    {
+                        linker_ = linker;
+                        add(ldflags_, "-fuse-ld=" + linker);
+                        add(rustflags_, "-C link-arg=-fuse-ld=" + linker);
+                    }
+                }
+                else if (!linker.empty() && linker != "default")
+                {
+                    log_error("Build profile " + name_ + ": linker must be mold, lld or default, not '" + linker + "'.");
+                    return false;
+                }
+                return true;
+            }
+
+            std::string name_;
+            Settings settings_;
+            std::string cflags_;
+            std::string cxxflags_;
+            std::string ldflags_;
+            std::string rustflags_;
+            std::string cargoLto_;
+            std::string linker_;
+        };
+
+        /**
+         * @brief Build profile of the current build (see createPackage()).
+         */
+        static BuildProfile buildProfile;
+
+        /**
+         * @class PgoBuild
+         * @brief Profile-guided optimization for STARBUILDs that set pgo="true".
+         *
+         * generate() exports instrumentation flags (CFLAGS, CXXFLAGS, LDFLAGS and
+         * RUSTFLAGS) that write raw profiles into a scratch directory; merge() turns
+         * what the training run left there into the package's cached profile
+         * (<cache>/pgo/<package>-<version>): clang and rustc .profraw files are merged
+         * with llvm-profdata, GCC's .gcda files (which GCC already accumulates across
+         * runs) are kept as a tree. use() then exports the flags that build against
+         * that profile. A cached profile lets later builds of the same version skip the
+         * instrumented pass.
+         */
+        class PgoBuild
+        {
+        public:
+            bool active() const { return stage_ != Stage::Off; }
+
+            /**
+             * @brief Picks the profile location and the C compiler flavour.
+             * @return True if a profile for this package version is already cached.
+             */
+            bool setup(const std::string &package, const std::string &version)
+            {
+                profileDir_ = defaultCacheRoot() / "pgo" / (package + "-" + version);
+                clang_ = compilerIsClang();
+                std::error_code ec;
+                return fs::exists(profileDir_ / kMergedProfile, ec) || fs::exists(profileDir_ / kGccProfiles, ec);
+            }
+
+            const fs::path &profileDir() const { return profileDir_; }
+
+            /**
+             * @brief Instrument the following phases; raw profiles go to rawDir.
+             */
+            void generate(const fs::path &rawDir, const fs::path &srcdir)
+            {
+                std::error_code ec;
+                fs::remove_all(rawDir, ec);
+                fs::create_directories(rawDir, ec);
+                rawDir_ = rawDir;
+                srcdir_ = fs::weakly_canonical(srcdir, ec); // GCC compares it with getcwd()
+                stage_ = Stage::Generate;
+            }
+
+            /**
+             * @brief Collects the training run's raw profiles into the profile cache.
+             * @return False if there was nothing to collect or merging failed.
+             */
+            bool merge()
+            {
+                TraceSpan span("pgo", "merge");
+                stage_ = Stage::Off;
+                std::vector<std::string> profraw;
+                bool gcda = false;
+                std::error_code ec;
+                for (auto it = fs::recursive_directory_iterator(rawDir_, ec);
+                     !ec && it != fs::recursive_directory_iterator(); it.increment(ec))
+                {
+                    if (it->path().extension() == ".profraw")
+                        profraw.push_back(it->path().string());
+                    else if (it->path().extension() == ".gcda")
+                        gcda = true;
+                }
+                if (profraw.empty() && !gcda)
+                {
+                    log_warning("PGO: the training run left no profile data in " + rawDir_.string() + ".");
+                    return false;
+                }
+
+                // Assemble the new profile next to the cache and swap it in as a whole
+                fs::path staging = profileDir_.string() + ".new";
+                fs::remove_all(staging, ec);
+                fs::create_directories(staging, ec);
+                if (!profraw.empty())
+                {
+                    std::string profdata = findInPath("llvm-profdata");
+                    if (profdata.empty())
+                    {
+                        log_warning("PGO: llvm-profdata is needed to merge " + std::to_string(profraw.size()) +
+                                    " .profraw file(s), but it is not installed.");
+                        fs::remove_all(staging, ec);
+                        return false;
+                    }
+                    ProcessSpec spec;
+                    spec.env = Environment::current();
+                    spec.argv = {profdata, "merge", "-o", (staging / kMergedProfile).string()};
+                    spec.argv.insert(spec.argv.end(), profraw.begin(), profraw.end());
+                    ProcessResult result;
+                    if (!runProcess(spec, result) || !result.succeeded())
+                    {
+                        log_warning("PGO: llvm-profdata merge failed.");
+                        fs::remove_all(staging, ec);
+                        return false;
+                    }
+                }
+                if (gcda)
+                {
+                    fs::copy(rawDir_, staging / kGccProfiles, fs::copy_options::recursive, ec);
+                    if (ec)
+                    {
+                        log_warning("PGO: could not save the GCC profile: " + ec.message());
+                        fs::remove_all(staging, ec);
+                        return false;
+                    }
+                }
+                fs::remove_all(profileDir_, ec);
+                fs::rename(staging, profileDir_, ec);
+                if (ec)
+                {
+                    log_warning("PGO: could not store the profile in " + profileDir_.string() + ": " + ec.message());
+                    fs::remove_all(staging, ec);
+                    return false;
+                }
+                log_message("PGO: saved the profile in " + profileDir_.string() + ".");
+                return true;
+            }
+
+            /**
+             * @brief Build the following phases against the cached profile.
+             */
+            void use(const fs::path &srcdir)
+            {
+                std::error_code ec;
+                srcdir_ = fs::weakly_canonical(srcdir, ec);
+                stage_ = Stage::Use;
+            }
+
+            void stop() { stage_ = Stage::Off; }
+
+            void apply(Environment &env) const
+            {
+                std::string cflags, ldflags, rustflags;
+                std::error_code ec;
+                if (stage_ == Stage::Generate)
+                {
+                    cflags = "-fprofile-generate=" + rawDir_.string();
+                    // Name GCC's profiles relative to the tree, so they apply wherever it is built
+                    if (!clang_)
+                        cflags += " -fprofile-update=prefer-atomic -fprofile-prefix-path=" + srcdir_.string();
+                    ldflags = "-fprofile-generate=" + rawDir_.string();
+                    rustflags = "-Cprofile-generate=" + rawDir_.string();
+                }
+                else if (stage_ == Stage::Use)
+                {
+                    fs::path merged = profileDir_ / kMergedProfile;
+                    fs::path gcc = profileDir_ / kGccProfiles;
+                    if (!clang_ && fs::exists(gcc, ec))
+                        cflags = "-fprofile-use=" + gcc.string() + " -fprofile-partial-training -fprofile-prefix-path=" +
+                                 srcdir_.string() + " -Wno-missing-profile";
+                    else if (clang_ && fs::exists(merged, ec))
+                        cflags = "-fprofile-use=" + merged.string() +
+                                 " -Wno-profile-instr-unprofiled -Wno-profile-instr-out-of-date";
+                    if (fs::exists(merged, ec))
+                        rustflags = "-Cprofile-use=" + merged.string();
+                }
+                else
+                {
+                    return;
+                }
+
+                auto append = [&](const char *key, const std::string &flags)
+                {
+                    if (flags.empty())
+                        return;
+                    const char *old = env.get(key);
+                    env.set(key, trim(std::string(old ? old : "") + " " + flags));
+                };
+                append("CFLAGS", cflags);
+                append("CXXFLAGS", cflags);
+                append("LDFLAGS", ldflags);
+                append("RUSTFLAGS", rustflags);
+            }
+
+        private:
+            enum class Stage
+            {
+                Off,
+                Generate,
+                Use
+            };
+
+            static constexpr const char *kMergedProfile = "merged.profdata";
+            static constexpr const char *kGccProfiles = "gcc";
+
+            Stage stage_ = Stage::Off;
+            bool clang_ = false;
+            fs::path profileDir_;
+            fs::path rawDir_;
+            fs::path srcdir_;
+        };
+
+        /**
+         * @brief PGO state of the current build (see createPackage()).
+         */
+        static PgoBuild pgoBuild;
+
+        /**
+         * @struct CgroupSample
+         * Counters of a cgroup v2 group (cpu.stat, io.stat, memory.peak, memory.events),
+         * used to account I/O bytes and CPU that rusage misses. take() reads our own
+         * group, which is only meaningful when the build has it to itself (e.g. under
+         * systemd-run or a CI job scope); phase cgroups are read with read().
+         */
+        struct CgroupSample
+        {
+            bool valid = false;
+            uint64_t cpuUsec = 0;
+            uint64_t throttledUsec = 0;
+            uint64_t ioReadBytes = 0;
+            uint64_t ioWriteBytes = 0;
+            uint64_t memoryPeak = 0;
+            uint64_t oomKills = 0;
+            // Read from our own group rather than a phase leaf: memory.peak is then the
+            // peak of the whole session so far, not of one phase.
+            bool sharedGroup = false;
+
+            static CgroupSample take()
+            {
+                std::string own = ownCgroupPath("");
+                if (own.empty())
+                    return {};
+                CgroupSample sample = read(cgroup2Root() / fs::path(own).relative_path());
+                sample.sharedGroup = true;
+                return sample;
+            }
+
+            static CgroupSample read(const fs::path &dir)
+            {
+                CgroupSample sample;
+                std::ifstream cpu(dir / "cpu.stat");
+                std::string key;
+                uint64_t value;
+                while (cpu >> key >> value)
+                {
+                    if (key == "usage_usec")
+                    {
+                        sample.cpuUsec = value;
+                        sample.valid = true;
+                    }
+                    else if (key == "throttled_usec")
+                        sample.throttledUsec = value;
+                }
+
+                std::ifstream events(dir / "memory.events");
+                while (events >> key >> value)
+                {
+                    if (key == "oom_kill")
+                        sample.oomKills = value;
+                }
+
+                // "<maj>:<min> rbytes=N wbytes=N rios=N ..." per device
+                std::ifstream io(dir / "io.stat");
+                std::string word;
+                while (io >> word)
+                {
+                    if (word.rfind("rbytes=", 0) == 0)
+                        sample.ioReadBytes += std::strtoull(word.c_str() + 7, nullptr, 10);
+                    else if (word.rfind("wbytes=", 0) == 0)
+                        sample.ioWriteBytes += std::strtoull(word.c_str() + 7, nullptr, 10);
+                }
+
+                std::string peak = readFirstLine((dir / "memory.peak").string());
+                if (!peak.empty())
+                    sample.memoryPeak = std::strtoull(peak.c_str(), nullptr, 10);
+                return sample;
+            }
+        };
+
+        /**
+         * @class BuildCgroups
+         * @brief Runs every build phase in a transient cgroup v2 leaf with the configured
+         *        limits, inside a subtree of the cgroup we were started in.
+         *
+         * Layout, below our own cgroup (which must be delegated to us, e.g. by
+         * "systemd-run --user --scope -p Delegate=yes"):
+         *
+         *     create-starpack.<pid>/            controllers enabled for the phases
+         *         supervisor/                   this process (no-internal-processes rule)
+         *         <package>-<phase>/            one leaf per phase, removed afterwards
+         *
+         * Phase processes enter their leaf between vfork() and exec() (see ProcessSpec),
+         * so no root daemon is needed. Limits need the memory/cpu/pids controllers to be
+         * delegated; without them phases still get their own group for accounting.
+         */
+        class BuildCgroups
+        {
+        public:
+            struct Phase
+            {
+                fs::path dir;
+                int procsFd = -1;
+            };
+
+            bool active() const { return !buildDir_.empty(); }
+
+            bool start()
+            {
+                std::string own = ownCgroupPath("");
+                if (own.empty())
+                {
+                    log_warning("cgroup v2 is not available; phases run without cgroup limits.");
+                    return false;
+                }
+                parentDir_ = cgroup2Root() / fs::path(own).relative_path();
+                removeStaleSiblings();
+                fs::path build = parentDir_ / ("create-starpack." + std::to_string(::getpid()));
+                fs::path supervisor = build / "supervisor";
+                if (::mkdir(build.c_str(), 0755) != 0 || ::mkdir(supervisor.c_str(), 0755) != 0)
+                {
+                    log_warning("Cannot create cgroup " + build.string() + ": " + strerror(errno) +
+                                " (is the cgroup delegated to this user?); phases run without cgroup limits.");
+                    ::rmdir(build.c_str());
+                    return false;
+                }
+                if (!writeFile(supervisor / "cgroup.procs", std::to_string(::getpid())))
+                {
+                    log_warning("Cannot move into " + supervisor.string() + ": " + strerror(errno) +
+                                "; phases run without cgroup limits.");
+                    ::rmdir(supervisor.c_str());
+                    ::rmdir(build.c_str());
+                    return false;
+                }
+                buildDir_ = build;
+
+                // Hand the controllers down: parent -> build dir -> phase leaves. What we
+                // add to the parent is taken away again in stop().
+                std::string before = readFirstLine((parentDir_ / "cgroup.subtree_control").string());
+                std::string wanted = enableControllers(parentDir_);
+                std::stringstream enabled(wanted);
+                std::string name;
+                parentEnabled_.clear();
+                while (enabled >> name)
+                {
+                    if (!hasWord(before, name))
+                        parentEnabled_.push_back(name);
+                }
+                enableControllers(buildDir_);
+                std::string missing;
+                for (const char *c : {"memory", "cpu", "pids"})
+                {
+                    if (wanted.find(c) == std::string::npos)
+                        missing += std::string(missing.empty() ? "" : ", ") + c;
+                }
+                if (!missing.empty() && (!cgroupMemoryMax.empty() || !cgroupMemoryHigh.empty() ||
+                                         !cgroupCpuMax.empty() || !cgroupPidsMax.empty()))
+                {
+                    log_warning("cgroup controllers not delegated (" + missing + "); their limits will not apply.");
+                }
+                log_message("Running build phases in cgroup " + buildDir_.string());
+                return true;
+            }
+
+            /**
+             * @brief Creates the leaf for one phase, applies the limits and opens its
+             *        cgroup.procs for the child to join.
+             */
+            bool createPhase(const std::string &name, Phase &phase)
+            {
+                if (!active())
+                    return false;
+                phase.dir = buildDir_ / name;
+                ::rmdir(phase.dir.c_str()); // leftover from an aborted phase
+                if (::mkdir(phase.dir.c_str(), 0755) != 0)
+                {
+                    log_warning("Cannot create cgroup " + phase.dir.string() + ": " + strerror(errno));
+                    return false;
+                }
+                applyLimit(phase.dir / "memory.max", cgroupMemoryMax);
+                applyLimit(phase.dir / "memory.high", cgroupMemoryHigh);
+                applyLimit(phase.dir / "cpu.max", cpuMaxValue(cgroupCpuMax));
+                applyLimit(phase.dir / "pids.max", cgroupPidsMax);
+                phase.procsFd = ::open((phase.dir / "cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC);
+                if (phase.procsFd < 0)
+                {
+                    log_warning("Cannot open " + (phase.dir / "cgroup.procs").string() + ": " + strerror(errno));
+                    ::rmdir(phase.dir.c_str());
+                    return false;
+                }
+                return true;
+            }
+
+            /**
+             * @brief Reads the phase's counters, kills anything the phase left running
+             *        and removes the leaf.
+             */
+            CgroupSample finishPhase(Phase &phase)
+            {
+                if (phase.procsFd >= 0)
+                    ::close(phase.procsFd);
+                phase.procsFd = -1;
+                CgroupSample sample = CgroupSample::read(phase.dir);
+                if (sample.oomKills > 0)
+                {
+                    log_warning(std::to_string(sample.oomKills) + " process(es) of " + phase.dir.filename().string() +
+                                " were killed by the OOM killer (memory.max=" +
+                                (cgroupMemoryMax.empty() ? "max" : cgroupMemoryMax) + ").");
+                }
+
+                // Daemons the phase left behind do not outlive it
+                if (!writeFile(phase.dir / "cgroup.kill", "1"))
+                {
+                    std::ifstream procs(phase.dir / "cgroup.procs");
+                    pid_t pid;
+                    while (procs >> pid)
+                        ::kill(pid, SIGKILL);
+                }
+                for (int i = 0; i < 100 && ::rmdir(phase.dir.c_str()) != 0 && errno == EBUSY; ++i)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                return sample;
+            }
+
+            /**
+             * @brief Leaves the build subtree and removes it.
+             *
+             * The no-internal-processes rule only lets us back into the parent once it
+             * no longer hands controllers to its children, so the controllers start()
+             * enabled are switched off first: in the build dir, then in the parent.
+             */
+            void stop()
+            {
+                if (!active())
+                    return;
+                disableControllers(buildDir_, splitWords(readFirstLine((buildDir_ / "cgroup.subtree_control").string())));
+                disableControllers(parentDir_, parentEnabled_);
+                if (writeFile(parentDir_ / "cgroup.procs", std::to_string(::getpid())))
+                {
+                    ::rmdir((buildDir_ / "supervisor").c_str());
+                    ::rmdir(buildDir_.c_str());
+                }
+                else
+                {
+                    log_warning("Cannot leave cgroup " + buildDir_.string() + ": " + strerror(errno));
+                }
+                buildDir_.clear();
+                parentEnabled_.clear();
+            }
+
+        private:
+            static bool writeFile(const fs::path &path, const std::string &value)
+            {
+                int fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+                if (fd < 0)
+                    return false;
+                bool ok = ::write(fd, value.data(), value.size()) == static_cast<ssize_t>(value.size());
+                int err = errno;
+                ::close(fd);
+                errno = err;
+                return ok;
+            }
+
+            static void applyLimit(const fs::path &file, const std::string &value)
+            {
+                if (!value.empty() && !writeFile(file, value))
+                    log_warning("Cannot set " + file.string() + " to '" + value + "': " + strerror(errno));
+            }
+
+            /**
+             * @brief Accepts cpu.max syntax ("200000 100000", "max") or a CPU count ("2.5").
+             */
+            static std::string cpuMaxValue(const std::string &value)
+            {
+                char *end = nullptr;
+                double cpus = std::strtod(value.c_str(), &end);
+                if (value.empty() || *end != '\0' || cpus <= 0)
+                    return value;
+                return std::to_string(static_cast<long>(cpus * 100000)) + " 100000";
+            }
+
+            /**
+             * @brief Enables memory, cpu, pids and io for the children of dir where
+             *        available; returns the controllers that are enabled afterwards.
+             */
+            static std::string enableControllers(const fs::path &dir)
+            {
+                std::string available = readFirstLine((dir / "cgroup.controllers").string());
+                std::stringstream ss(available);
+                std::string name;
+                while (ss >> name)
+                {
+                    if (name == "memory" || name == "cpu" || name == "pids" || name == "io")
+                        writeFile(dir / "cgroup.subtree_control", "+" + name);
+                }
+                return readFirstLine((dir / "cgroup.subtree_control").string());
+            }
+
+            static std::vector<std::string> splitWords(const std::string &line)
+            {
+                std::vector<std::string> words;
+                std::stringstream ss(line);
+                std::string word;
+                while (ss >> word)
+                    words.push_back(word);
+                return words;
+            }
+
+            static bool hasWord(const std::string &line, const std::string &word)
+            {
+                auto words = splitWords(line);
+                return std::find(words.begin(), words.end(), word) != words.end();
+            }
+
+            static void disableControllers(const fs::path &dir, const std::vector<std::string> &names)
+            {
+                for (const auto &name : names)
+                    writeFile(dir / "cgroup.subtree_control", "-" + name);
+            }
+
+            /**
+             * @brief Removes the empty subtrees of create-starpack runs that are gone
+             *        (e.g. killed before stop()).
+             */
+            void removeStaleSiblings()
+            {
+                std::error_code ec;
+                for (const auto &entry : fs::directory_iterator(parentDir_, ec))
+                {
+                    std::string name = entry.path().filename().string();
+                    if (name.rfind("create-starpack.", 0) != 0 || !entry.is_directory(ec))
+                        continue;
+                    pid_t pid = static_cast<pid_t>(std::atol(name.c_str() + 16));
+                    if (pid <= 0 || ::kill(pid, 0) == 0 || errno != ESRCH)
+                        continue; // still running, or not ours to judge
+                    for (const auto &child : fs::directory_iterator(entry.path(), ec))
+                    {
+                        if (child.is_directory(ec))
+                            ::rmdir(child.path().c_str());
+                    }
+                    ::rmdir(entry.path().c_str());
+                }
+            }
+
+            fs::path parentDir_;
+            std::vector<std::string> parentEnabled_;
+            fs::path buildDir_;
+        };
+
+        /**
+         * @brief Phase cgroups of the current build (see createPackage()).
+         */
+        static BuildCgroups buildCgroups;
+
+        /**
+         * @class BuildReport
+         * @brief Per-phase resource usage of one build, written as
+         *        "<package>-<version>.build.json" next to the produced .starpack files.
+         *
+         * Each phase records wall time and the rusage of its children as returned by
+         * wait4() (user/system CPU, peak RSS, block I/O operations, voluntary and
+         * involuntary context switches), plus cgroup v2 deltas when available.
+         */
+        class BuildReport
+        {
+        public:
+            void reset(const std::string &package, const std::string &version, unsigned jobs)
+            {
+                package_ = package;
+                version_ = version;
+                jobs_ = jobs;
+                phases_.clear();
+                compilerCache_ = {};
+                start_ = std::chrono::steady_clock::now();
+            }
+
+            void setCompilerCache(const CompilerCacheStats &stats) { compilerCache_ = stats; }
+
+            void record(const std::string &package, const std::string &phase,
+                        const ProcessResult &result, const CgroupSample &before, const CgroupSample &after,
+                        const std::string &abortReason = "")
+            {
+                if (result.status == -1)
+                    return; // nothing was run
+                phases_.push_back({package, phase, result, before, after, abortReason});
+            }
+
+            bool write(const fs::path &path, bool succeeded) const
+            {
+                auto seconds = [](const timeval &tv)
+                { return static_cast<double>(tv.tv_sec) + tv.tv_usec / 1e6; };
+
+                std::ostringstream out;
+                out.setf(std::ios::fixed);
+                out.precision(3);
+                out << "{\n"
+                    << "  \"package\": \"" << jsonEscape(package_) << "\",\n"
+                    << "  \"version\": \"" << jsonEscape(version_) << "\",\n"
+                    << "  \"jobs\": " << jobs_ << ",\n"
+                    << "  \"succeeded\": " << (succeeded ? "true" : "false") << ",\n"
+                    << "  \"wall_seconds\": "
+                    << std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count() << ",\n"
+                    << "  \"phases\": [";
+                for (size_t i = 0; i < phases_.size(); ++i)
+                {
+                    const Phase &p = phases_[i];
+                    const struct rusage &ru = p.result.usage;
+                    out << (i ? "," : "") << "\n    {\n"
+                        << "      \"package\": \"" << jsonEscape(p.package) << "\",\n"
+                        << "      \"phase\": \"" << jsonEscape(p.phase) << "\",\n"
+                        << "      \"exit_status\": "
+                        << (WIFEXITED(p.result.status) ? WEXITSTATUS(p.result.status) : 128 + WTERMSIG(p.result.status)) << ",\n";
+                    if (!p.abortReason.empty())
+                        out << "      \"aborted\": \"" << p.abortReason << "\",\n";
+                    out
+                        << "      \"wall_seconds\": " << std::chrono::duration<double>(p.result.wallTime).count() << ",\n"
+                        << "      \"user_cpu_seconds\": " << seconds(ru.ru_utime) << ",\n"
+                        << "      \"system_cpu_seconds\": " << seconds(ru.ru_stime) << ",\n"
+                        << "      \"max_rss_kib\": " << ru.ru_maxrss << ",\n"
+                        << "      \"block_input_ops\": " << ru.ru_inblock << ",\n"
+                        << "      \"block_output_ops\": " << ru.ru_oublock << ",\n"
+                        << "      \"voluntary_context_switches\": " << ru.ru_nvcsw << ",\n"
+                        << "      \"involuntary_context_switches\": " << ru.ru_nivcsw;
+                    if (p.before.valid && p.after.valid)
+                    {
+                        out << ",\n      \"cgroup\": {\n"
+                            << "        \"cpu_usec\": " << p.after.cpuUsec - p.before.cpuUsec << ",\n"
+                            << "        \"cpu_throttled_usec\": " << p.after.throttledUsec - p.before.throttledUsec << ",\n"
+                            << "        \"io_read_bytes\": " << p.after.ioReadBytes - p.before.ioReadBytes << ",\n"
+                            << "        \"io_write_bytes\": " << p.after.ioWriteBytes - p.before.ioWriteBytes << ",\n";
+                        if (!p.after.sharedGroup)
+                            out << "        \"memory_peak_bytes\": " << p.after.memoryPeak << ",\n";
+                        out << "        \"oom_kills\": " << p.after.oomKills - p.before.oomKills << "\n"
+                            << "      }";
+                    }
+                    out << "\n    }";
+                }
+                out << "\n  ]";
+                if (compilerCache_.ccache || compilerCache_.sccache)
+                {
+                    out << ",\n  \"compiler_cache\": {";
+                    if (compilerCache_.ccache)
+                        out << "\n    \"ccache_hits\": " << compilerCache_.ccacheHits
+                            << ",\n    \"ccache_misses\": " << compilerCache_.ccacheMisses
+                            << (compilerCache_.sccache ? "," : "");
+                    if (compilerCache_.sccache)
+                        out << "\n    \"sccache_hits\": " << compilerCache_.sccacheHits
+                            << ",\n    \"sccache_misses\": " << compilerCache_.sccacheMisses;
+                    out << "\n  }";
+                }
+                out << "\n}\n";
+
+                std::ofstream file(path, std::ios::binary | std::ios::trunc);
+                if (!(file << out.str()))
+                {
+                    log_warning("Could not write build report " + path.string());
+                    return false;
+                }
+                log_message("Wrote build report " + path.string());
+                return true;
+            }
+
+        private:
+            struct Phase
+            {
+                std::string package;
+                std::string phase;
+                ProcessResult result;
+                CgroupSample before;
+                CgroupSample after;
+                std::string abortReason;
+            };
+
+            std::string package_;
+            std::string version_;
+            unsigned jobs_ = 0;
+            std::vector<Phase> phases_;
+            CompilerCacheStats compilerCache_;
+            std::chrono::steady_clock::time_point start_;
+        };
+
+        /**
+         * @brief Resource report of the current build (see createPackage()).
+         */
+        static BuildReport buildReport;
+
+        /**
+         * @class JobServer
+         * @brief GNU make jobserver that caps total parallelism of build scripts.
+         *
+         * Three modes:
+         *  - join: MAKEFLAGS we inherited already names a jobserver (we run under make
+         *    or another coordinator); it is passed through to build scripts unchanged.
+         *  - private pool (--jobserver): an anonymous pipe holding jobs-1 tokens.
+         *  - shared pool (--jobserver=PATH): a named FIFO shared by every
+         *    create-starpack using the same PATH. The first instance to take the
+         *    exclusive lock on PATH.lock (re)creates the FIFO and fills it with jobs
+         *    tokens; every instance then holds a shared lock for as long as it uses
+         *    the pool. The implicit slot of each build's top-level make is backed by
+         *    a token the build takes before each phase (see acquireSlot()), so any
+         *    number of builds on one pool run at most jobs jobs together.
+         *
+         * Pools are handed to children as "--jobserver-auth=R,W" descriptors, which
+         * every make since 4.2 understands (for the FIFO both are one O_RDWR
+         * descriptor), plus CARGO_MAKEFLAGS for cargo.
+         */
+        class JobServer
+        {
+        public:
+            ~JobServer() { close(); }
+
+            /**
+             * @brief Picks up a jobserver advertised in our own MAKEFLAGS.
+             */
+            bool joinInherited()
+            {
+                const char *makeflags = getenv("MAKEFLAGS");
+                if (!makeflags)
+                    return false;
+                std::string flags = makeflags;
+                size_t pos = flags.find("--jobserver-auth=");
+                size_t len = std::string("--jobserver-auth=").size();
+                if (pos == std::string::npos)
+                {
+                    pos = flags.find("--jobserver-fds=");
+                    len = std::string("--jobserver-fds=").size();
+                }
+                if (pos == std::string::npos)
+                    return false;
+
+                std::string auth = flags.substr(pos + len, flags.find(' ', pos) - pos - len);
+                if (auth.rfind("fifo:", 0) != 0)
+                {
+                    int r = -1, w = -1;
+                    if (std::sscanf(auth.c_str(), "%d,%d", &r, &w) != 2 ||
+                        ::fcntl(r, F_GETFD) < 0 || ::fcntl(w, F_GETFD) < 0)
+                    {
+                        log_warning("Ignoring inherited jobserver '" + auth + "': descriptors are not open.");
+                        return false;
+                    }
+                    readFd_ = relocate(r, false);
+                    writeFd_ = relocate(w, false);
+                    ownsFds_ = true;
+                    if (readFd_ < 0 || writeFd_ < 0)
+                    {
+                        close();
+                        return false;
+                    }
+                    flags.replace(pos + len, auth.size(), std::to_string(readFd_) + "," + std::to_string(writeFd_));
+                }
+                inheritedFlags_ = flags;
+                mode_ = Mode::Joined;
+                log_message("Joining inherited make jobserver (" + auth + ").");
+                return true;
+            }
+
+            /**
+             * @brief Creates a private pool of jobs-1 tokens.
+             */
+            bool createPrivate(unsigned jobs)
+            {
+                int fds[2];
+                if (::pipe2(fds, O_CLOEXEC) != 0)
+                {
+                    log_warning(std::string("Could not create jobserver pipe: ") + strerror(errno));
+                    return false;
+                }
+                readFd_ = relocate(fds[0], true);
+                writeFd_ = relocate(fds[1], true);
+                ownsFds_ = true;
+                if (readFd_ < 0 || writeFd_ < 0 || !fillTokens(writeFd_, jobs))
+                {
+                    close();
+                    return false;
+                }
+                jobs_ = jobs;
+                mode_ = Mode::Serving;
+                log_message("Started make jobserver with " + std::to_string(jobs) + " job slots.");
+                return true;
+            }
+
+            /**
+             * @brief Joins (or, if nobody else is using it, creates) a pool shared
+             *        through the named FIFO at path.
+             */
+            bool openShared(const std::string &path, unsigned jobs)
+            {
+                std::string lockPath = path + ".lock";
+                lockFd_ = ::open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+                if (lockFd_ < 0)
+                {
+                    log_warning("Could not open jobserver lock " + lockPath + ": " + strerror(errno));
+                    return false;
+                }
+
+                bool first = ::flock(lockFd_, LOCK_EX | LOCK_NB) == 0;
+                if (first)
+                {
+                    // Nobody else holds the pool: start it afresh with a full set of tokens.
+                    ::unlink(path.c_str());
+                    if (::mkfifo(path.c_str(), 0666) != 0)
+                    {
+                        log_warning("Could not create jobserver FIFO " + path + ": " + strerror(errno));
+                        close();
+                        return false;
+                    }
+                }
+                else if (::flock(lockFd_, LOCK_SH) != 0)
+                {
+                    close();
+                    return false;
+                }
+
+                int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+                if (fd < 0)
+                {
+                    log_warning("Could not open jobserver FIFO " + path + ": " + strerror(errno));
+                    close();
+                    return false;
+                }
+                readFd_ = writeFd_ = relocate(fd, true);
+                ownsFds_ = true;
+                if (readFd_ < 0)
+                {
+                    close();
+                    return false;
+                }
+
+                if (first)
+                {
+                    // The pool size goes into the lock file so later builds advertise
+                    // the -j that matches the tokens actually in the FIFO.
+                    std::string size = std::to_string(jobs) + "\n";
+                    if (::ftruncate(lockFd_, 0) != 0 || ::pwrite(lockFd_, size.data(), size.size(), 0) < 0 ||
+                        !fillTokens(writeFd_, jobs + 1))
+                    {
+                        close();
+                        return false;
+                    }
+                    ::flock(lockFd_, LOCK_SH); // downgrade so other builds can join
+                }
+                else
+                {
+                    char buf[32] = {};
+                    unsigned poolJobs = 0;
+                    if (::pread(lockFd_, buf, sizeof(buf) - 1, 0) > 0)
+                        poolJobs = static_cast<unsigned>(std::strtoul(buf, nullptr, 10));
+                    if (poolJobs > 0 && poolJobs != jobs)
+                    {
+                        log_warning("Shared jobserver " + path + " has " + std::to_string(poolJobs) +
+                                    " job slots; using that instead of " + std::to_string(jobs) + ".");
+                        jobs = poolJobs;
+                    }
+                }
+                jobs_ = jobs;
+                mode_ = Mode::Serving;
+                shared_ = true;
+                log_message(std::string(first ? "Created" : "Joined") + " shared make jobserver " + path + " with " +
+                            std::to_string(jobs) + " job slots.");
+                return true;
+            }
+
+            /**
+             * @brief Passes the jobserver to a child: makes the descriptors inheritable
+             *        and advertises them in MAKEFLAGS.
+             */
+            void apply(ProcessSpec &spec) const
+            {
+                if (mode_ == Mode::None)
+                    return;
+
+                if (readFd_ >= 0)
+                {
+                    spec.fds.push_back({readFd_, readFd_});
+                    if (writeFd_ != readFd_)
+                        spec.fds.push_back({writeFd_, writeFd_});
+                }
+
+                std::string flags;
+                if (mode_ == Mode::Joined)
+                {
+                    flags = inheritedFlags_;
+                }
+                else
+                {
+                    // Keep unrelated flags, replace any -j with ours.
+                    const char *existing = spec.env.get("MAKEFLAGS");
+                    std::stringstream ss(existing ? existing : "");
+                    std::string word;
+                    while (ss >> word)
+                    {
+                        if (word.rfind("-j", 0) != 0 && word.rfind("--jobserver", 0) != 0)
+                            flags += word + " ";
+                    }
+                    std::string fds = std::to_string(readFd_) + "," + std::to_string(writeFd_);
+                    flags += "-j" + std::to_string(jobs_) + " --jobserver-auth=" + fds;
+                }
+                spec.env.set("MAKEFLAGS", flags);
+                spec.env.set("CARGO_MAKEFLAGS", flags);
+            }
+
+            bool active() const { return mode_ != Mode::None; }
+
+            /**
+             * @brief On a shared pool, blocks until a token is free and keeps it as the
+             *        slot of the phase about to run. Does nothing for other modes.
+             */
+            bool acquireSlot()
+            {
+                if (!shared_ || heldToken_)
+                    return true;
+                bool waited = false;
+                char token;
+                while (true)
+                {
+                    struct pollfd pfd = {readFd_, POLLIN, 0};
+                    if (::poll(&pfd, 1, waited ? -1 : 0) > 0)
+                    {
+                        ssize_t n = ::read(readFd_, &token, 1);
+                        if (n == 1)
+                            break;
+                        if (n < 0 && errno != EINTR && errno != EAGAIN)
+                        {
+                            log_warning(std::string("Could not take a jobserver token: ") + strerror(errno));
+                            return false;
+                        }
+                    }
+                    else if (!waited)
+                    {
+                        log_message("Waiting for a free slot in the shared jobserver...");
+                        waited = true;
+                    }
+                }
+                token_ = token;
+                heldToken_ = true;
+                return true;
+            }
+
+            /**
+             * @brief Returns the token taken by acquireSlot().
+             */
+            void releaseSlot()
+            {
+                if (!heldToken_)
+                    return;
+                while (::write(writeFd_, &token_, 1) < 0 && errno == EINTR)
+                {
+                }
+                heldToken_ = false;
+            }
+
+            void close()
+            {
+                releaseSlot();
+                if (ownsFds_)
+                {
+                    if (readFd_ >= 0)
+                        ::close(readFd_);
+                    if (writeFd_ >= 0 && writeFd_ != readFd_)
+                        ::close(writeFd_);
+                }
+                if (lockFd_ >= 0)
+                    ::close(lockFd_); // releases the flock
+                readFd_ = writeFd_ = lockFd_ = -1;
+                ownsFds_ = false;
+                shared_ = false;
+                mode_ = Mode::None;
+            }
+
+        private:
+            enum class Mode
+            {
+                None,
+                Joined,
+                Serving
+            };
+
+            /**
+             * @brief Moves a descriptor above the low numbers build scripts are handed
+             *        (the script itself is fd 3), so passing it on cannot clobber it.
+             */
+            static int relocate(int fd, bool closeOld)
+            {
+                int moved = ::fcntl(fd, F_DUPFD_CLOEXEC, kJobserverFdBase);
+                if (moved < 0)
+                    log_warning(std::string("Could not move jobserver descriptor: ") + strerror(errno));
+                if (closeOld)
+                    ::close(fd);
+                return moved;
+            }
+
+            static constexpr int kJobserverFdBase = 10;
+
+            /**
+             * @brief Writes jobs-1 tokens; every make also owns one implicit slot (which
+             *        on a shared pool is itself one of the tokens, see acquireSlot()).
+             */
+            static bool fillTokens(int fd, unsigned jobs)
+            {
+                std::string tokens(jobs > 1 ? jobs - 1 : 0, '+');
+                if (!tokens.empty() && ::write(fd, tokens.data(), tokens.size()) != static_cast<ssize_t>(tokens.size()))
+                {
+                    log_warning(std::string("Could not fill jobserver: ") + strerror(errno));
+                    return false;
+                }
+                return true;
+            }
+
+            Mode mode_ = Mode::None;
+            int readFd_ = -1;
+            int writeFd_ = -1;
+            int lockFd_ = -1;
+            bool ownsFds_ = false;
+            bool shared_ = false;
+            bool heldToken_ = false;
+            char token_ = '+';
+            unsigned jobs_ = 0;
+            std::string inheritedFlags_;
+        };
+
+        /**
+         * @brief The jobserver of the current build (see createPackage()).
+         */
+        static JobServer jobServer;
+
+        /**
+         * @brief runWithBash: Runs a script with /bin/bash, optionally under fakeroot.
+         *
+         * With fakeroot enabled the script joins the build's shared FakerootSession.
+         * The script is passed through a memfd on descriptor 3 and executed as
+         * "bash /dev/fd/3", with an explicit environment block that adds pkgdir,
+         * packagedir, srcdir, package_name, package_version and the parallel job
+         * settings (see exportBuildJobs() and JobServer), the BuildProfile's compiler
+         * flags, plus the CompilerCache and PgoBuild variables while those are active.
+         * No intermediate shell or quoting is involved. If the script is empty, does nothing.
+         *
+         * @param script The shell script content to run.
+         * @param pkg_packagedir The "files/" directory for the subpackage or single package
+         * @param srcdir The directory containing STARBUILD and any local source files
+         * @param package_name The subpackage or single package name
+         * @param package_version The package version
+         * @param customFuncs Helper function definitions to prepend to the script
+         * @param context If given: where to log output (see PhaseLog; its tail is printed
+         *        if the script fails), which cgroup and directory to run in; receives the exit
+         *        status, wall time and rusage of the run.
+         * @return True if script returns 0, false otherwise.
+         */
+        static bool runWithBash(const std::string &script,
+                                const std::string &pkg_packagedir,
+                                const std::string &srcdir,
+                                const std::string &package_name,
+                                const std::string &package_version,
+                                const std::vector<std::string> &customFuncs,
+                                PhaseContext *context = nullptr)
+        {
+            // Nothing to do if there's no script body
+            if (script.empty() && customFuncs.empty())
+                return true;
+
+            TraceSpan span("build", "runWithBash");
+            span.arg("package", package_name);
+
+            // 1) Combine helper-function definitions + the real script. The script's own
+            //    descriptor is closed first so build tools don't inherit it.
+            std::string fullScript = "exec 3<&-\n";
+            for (auto const &fnDef : customFuncs)
+            {
+                fullScript += fnDef;
+                if (fnDef.back() != '\n')
+                    fullScript += "\n";
+            }
+            fullScript += script;
+
+            int scriptFd = createScriptFd(fullScript);
+            if (scriptFd < 0)
+            {
+                log_error(std::string("Could not create script file: ") + strerror(errno));
+                return false;
+            }
+
+            // 2) Build the environment block
+            ProcessSpec spec;
+            spec.env = Environment::current();
+            spec.env.set("pkgdir", pkg_packagedir);
+            spec.env.set("packagedir", pkg_packagedir);
+            spec.env.set("srcdir", srcdir);
+            spec.env.set("package_name", package_name);
+            spec.env.set("package_version", package_version);
+            exportBuildJobs(spec.env, buildJobs, jobServer.active());
+            if (compilerCache.active())
+                compilerCache.apply(spec.env);
+            buildProfile.apply(spec.env);
+            if (pgoBuild.active())
+                pgoBuild.apply(spec.env);
+
+            // 3) Build argv, attaching to the build's fakeroot session if enabled
+            spec.argv = {"/bin/bash", "/dev/fd/3"};
+            spec.fds = {{scriptFd, 3}};
+            jobServer.apply(spec);
+            if (context)
+            {
+                spec.cgroupProcsFd = context->cgroupProcsFd;
+                spec.cwd = context->workingDirectory.string();
+            }
+            if (useFakeroot && !fakerootSession.wrap(spec))
+            {
+                ::close(scriptFd);
+                return false;
+            }
+
+            // 4) Execute. Phases run supervised (see superviseProcess()) in their own
+            //    process group with stdin from /dev/null, their output captured through
+            //    pipes when a log is requested. On a shared jobserver the script's own
+            //    job slot is a token taken from the pool for as long as it runs.
+            struct SlotGuard
+            {
+                ~SlotGuard() { jobServer.releaseSlot(); }
+            } slotGuard;
+            if (!jobServer.acquireSlot())
+            {
+                ::close(scriptFd);
+                return false;
+            }
+            ProcessResult result;
+            bool launched;
+            PhaseLog log;
+            if (context)
+            {
+                int outPipe[2] = {-1, -1}, errPipe[2] = {-1, -1};
+                if (!context->logPath.empty() && log.open(context->logPath))
+                {
+                    if (::pipe2(outPipe, O_CLOEXEC) != 0 || ::pipe2(errPipe, O_CLOEXEC) != 0)
+                    {
+                        log_error(std::string("Could not create output pipes: ") + strerror(errno));
+                        ::close(scriptFd);
+                        return false;
+                    }
+                    spec.fds.push_back({outPipe[1], STDOUT_FILENO});
+                    spec.fds.push_back({errPipe[1], STDERR_FILENO});
+                }
+                int nullFd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+                if (nullFd >= 0)
+                    spec.fds.push_back({nullFd, STDIN_FILENO});
+                spec.newProcessGroup = true;
+
+                auto start = std::chrono::steady_clock::now();
+                std::string error;
+                pid_t pid = spawnProcess(spec, error);
+                for (int fd : {outPipe[1], errPipe[1], nullFd})
+                {
+                    if (fd >= 0)
+                        ::close(fd);
+                }
+                if (pid < 0)
+                {
+                    log_error("Failed to launch " + spec.argv[0] + ": " + error);
+                    launched = false;
+                }
+                else
+                {
+                    launched = superviseProcess(pid, outPipe[0], errPipe[0], log.path().empty() ? nullptr : &log, *context);
+                }
+                result = context->result;
+                result.wallTime = std::chrono::steady_clock::now() - start;
+                for (int fd : {outPipe[0], errPipe[0]})
+                {
+                    if (fd >= 0)
+                        ::close(fd);
+                }
+                log.close();
+            }
+            else
+            {
+                launched = runProcess(spec, result);
+            }
+            ::close(scriptFd);
+            if (context)
+                context->result = result;
+
+            bool ok = launched && result.succeeded();
+            if (!ok && !log.path().empty())
+            {
+                std::vector<std::string> tail = log.tail();
+                std::string report = "Last " + std::to_string(tail.size()) + " lines of output (full log: " +
+                                     log.path().string() + "):";
+                for (const auto &line : tail)
+                    report += "\n    " + line;
+                log_error(report);
+            }
+            return ok;
+        }
+
+        /**
+         * @struct ElfInfo
+         * What inspectElf() found out about a file.
+         */
+        struct ElfInfo
+        {
+            bool isElf = false;
+            bool hasSymbols = false; ///< Has a .symtab or .debug_* / .zdebug_* section
+            bool hasDebug = false;   ///< Has .debug_* / .zdebug_* sections
+            std::string buildId;     ///< NT_GNU_BUILD_ID as lowercase hex, if present
+            std::string soname;      ///< DT_SONAME (only read when asked for)
+            std::vector<std::string> needed; ///< DT_NEEDED entries (only read when asked for)
+        };
+
+        /**
+         * @brief True if the 16 bytes of ident are a valid ELF identification.
+         */
+        static bool hasElfIdent(const unsigned char *ident)
+        {
+            return memcmp(ident, ELFMAG, SELFMAG) == 0 &&
+                   (ident[EI_CLASS] == ELFCLASS32 || ident[EI_CLASS] == ELFCLASS64) &&
+                   (ident[EI_DATA] == ELFDATA2LSB || ident[EI_DATA] == ELFDATA2MSB);
+        }
+
+        /**
+         * @brief Reads an ELF file's identification and section table.
+         *
+         * Only the 16-byte e_ident, the ELF header, the section header table, the
+         * section name table and the build-id note are read, never the whole file.
+         * With readDynamic, the .dynamic section and its string table are read too,
+         * for the DT_SONAME and DT_NEEDED entries. Both classes and both byte orders
+         * are handled.
+         */
+        static bool inspectElf(const fs::path &path, ElfInfo &info, bool readDynamic = false)
+        {
+            info = ElfInfo();
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                return false;
+            struct FdCloser
+            {
+                int fd;
+                ~FdCloser() { ::close(fd); }
+            } closer{fd};
+            struct stat st;
+            if (::fstat(fd, &st) != 0)
+                return false;
+            // Every table below must lie inside the file before anything is allocated for it
+            const uint64_t fileSize = static_cast<uint64_t>(st.st_size);
+            auto inFile = [fileSize](uint64_t offset, uint64_t length)
+            { return offset <= fileSize && length <= fileSize - offset; };
+
+            unsigned char ident[EI_NIDENT];
+            if (::pread(fd, ident, sizeof(ident), 0) != static_cast<ssize_t>(sizeof(ident)) || !hasElfIdent(ident))
+                return true; // readable, just not ELF
+            info.isElf = true;
+
+            const bool is64 = ident[EI_CLASS] == ELFCLASS64;
+            const bool swap = (ident[EI_DATA] == ELFDATA2LSB) != (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+            auto fix16 = [&](uint16_t v)
+            { return swap ? __builtin_bswap16(v) : v; };
+            auto fix32 = [&](uint32_t v)
+            { return swap ? __builtin_bswap32(v) : v; };
+            auto fix64 = [&](uint64_t v)
+            { return swap ? __builtin_bswap64(v) : v; };
+
+            uint64_t shoff;
+            uint32_t shentsize, shnum, shstrndx;
+            if (is64)
+            {
+                Elf64_Ehdr eh;
+                if (::pread(fd, &eh, sizeof(eh), 0) != static_cast<ssize_t>(sizeof(eh)))
+                    return true;
+                shoff = fix64(eh.e_shoff);
+                shentsize = fix16(eh.e_shentsize);
+                shnum = fix16(eh.e_shnum);
+                shstrndx = fix16(eh.e_shstrndx);
+            }
+            else
+            {
+                Elf32_Ehdr eh;
+                if (::pread(fd, &eh, sizeof(eh), 0) != static_cast<ssize_t>(sizeof(eh)))
+                    return true;
+                shoff = fix32(eh.e_shoff);
+                shentsize = fix16(eh.e_shentsize);
+                shnum = fix16(eh.e_shnum);
+                shstrndx = fix16(eh.e_shstrndx);
+            }
+            if (shoff == 0 || shentsize < (is64 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr)))
+                return true; // no section table: nothing strip could remove
+
+            struct Section
+            {
+                uint32_t name;
+                uint64_t offset;
+                uint64_t size;
+                uint32_t link;
+            };
+            auto readSection = [&](uint64_t index, Section &sec)
+            {
+                if (is64)
+                {
+                    Elf64_Shdr sh;
+                    if (::pread(fd, &sh, sizeof(sh), shoff + index * shentsize) != static_cast<ssize_t>(sizeof(sh)))
+                        return false;
+                    sec = {fix32(sh.sh_name), fix64(sh.sh_offset), fix64(sh.sh_size), fix32(sh.sh_link)};
+                }
+                else
+                {
+                    Elf32_Shdr sh;
+                    if (::pread(fd, &sh, sizeof(sh), shoff + index * shentsize) != static_cast<ssize_t>(sizeof(sh)))
+                        return false;
+                    sec = {fix32(sh.sh_name), fix32(sh.sh_offset), fix32(sh.sh_size), fix32(sh.sh_link)};
+                }
+                return true;
+            };
+
+            // Extended numbering keeps the real counts in section 0
+            Section first;
+            if (!readSection(0, first))
+                return true;
+            uint64_t count = shnum != 0 ? shnum : first.size;
+            uint64_t strIndex = shstrndx != SHN_XINDEX ? shstrndx : first.link;
+            if (count == 0 || count > 65536 * 16 || strIndex >= count || !inFile(shoff, count * shentsize))
+                return true;
+
+            std::vector<char> table(count * shentsize);
+            if (::pread(fd, table.data(), table.size(), shoff) != static_cast<ssize_t>(table.size()))
+                return true;
+            Section names;
+            if (!readSection(strIndex, names) || names.size == 0 || names.size > (64u << 20) ||
+                !inFile(names.offset, names.size))
+                return true;
+            std::vector<char> strtab(names.size + 1, '\0');
+            if (::pread(fd, strtab.data(), names.size, names.offset) != static_cast<ssize_t>(names.size))
+                return true;
+
+            uint64_t buildIdSection = 0, dynamicSection = 0;
+            for (uint64_t i = 1; i < count; ++i)
+            {
+                uint32_t nameOffset, type;
+                memcpy(&nameOffset, table.data() + i * shentsize, sizeof(nameOffset)); // sh_name and sh_type come first in both classes
+                memcpy(&type, table.data() + i * shentsize + 4, sizeof(type));
+                nameOffset = fix32(nameOffset);
+                if (fix32(type) == SHT_DYNAMIC)
+                    dynamicSection = i;
+                if (nameOffset >= names.size)
+                    continue;
+                const char *name = strtab.data() + nameOffset;
+                if (strncmp(name, ".debug_", 7) == 0 || strncmp(name, ".zdebug_", 8) == 0)
+                    info.hasSymbols = info.hasDebug = true;
+                else if (strcmp(name, ".symtab") == 0)
+                    info.hasSymbols = true;
+                else if (strcmp(name, ".note.gnu.build-id") == 0)
+                    buildIdSection = i;
+            }
+
+            // One note: namesz, descsz, type, "GNU\0", then the id itself
+            Section note;
+            if (buildIdSection != 0 && readSection(buildIdSection, note) && note.size >= 16 && note.size <= 1024 &&
+                inFile(note.offset, note.size))
+            {
+                std::vector<unsigned char> data(note.size);
+                if (::pread(fd, data.data(), data.size(), note.offset) == static_cast<ssize_t>(data.size()))
+                {
+                    uint32_t words[3];
+                    memcpy(words, data.data(), sizeof(words));
+                    uint32_t namesz = fix32(words[0]), descsz = fix32(words[1]), type = fix32(words[2]);
+                    size_t descOffset = 12 + ((namesz + 3) & ~3u);
+                    if (type == NT_GNU_BUILD_ID && namesz == 4 && memcmp(data.data() + 12, "GNU", 4) == 0 &&
+                        descsz > 0 && descOffset + descsz <= data.size())
+                    {
+                        static const char hex[] = "0123456789abcdef";
+                        for (size_t i = 0; i < descsz; ++i)
+                        {
+                            info.buildId += hex[data[descOffset + i] >> 4];
+                            info.buildId += hex[data[descOffset + i] & 0xf];
+                        }
+                    }
+                }
+            }
+
+            // Dynamic entries point into the string table named by the section's sh_link
+            Section dynamic, dynstr;
+            if (!readDynamic || dynamicSection == 0 || !readSection(dynamicSection, dynamic) ||
+                dynamic.size == 0 || dynamic.size > (16u << 20) || !inFile(dynamic.offset, dynamic.size) ||
+                dynamic.link >= count || !readSection(dynamic.link, dynstr) || dynstr.size == 0 ||
+                dynstr.size > (64u << 20) || !inFile(dynstr.offset, dynstr.size))
+                return true;
+            std::vector<char> entries(dynamic.size);
+            std::vector<char> strings(dynstr.size + 1, '\0');
+            if (::pread(fd, entries.data(), entries.size(), dynamic.offset) != static_cast<ssize_t>(entries.size()) ||
+                ::pread(fd, strings.data(), dynstr.size, dynstr.offset) != static_cast<ssize_t>(dynstr.size))
+                return true;
+            const size_t entrySize = is64 ? sizeof(Elf64_Dyn) : sizeof(Elf32_Dyn);
+            for (size_t off = 0; off + entrySize <= entries.size(); off += entrySize)
+            {
+                uint64_t tag, value;
+                if (is64)
+                {
+                    Elf64_Dyn d;
+                    memcpy(&d, entries.data() + off, sizeof(d));
+                    tag = fix64(static_cast<uint64_t>(d.d_tag));
+                    value = fix64(d.d_un.d_val);
+                }
+                else
+                {
+                    Elf32_Dyn d;
+                    memcpy(&d, entries.data() + off, sizeof(d));
+                    tag = fix32(static_cast<uint32_t>(d.d_tag));
+                    value = fix32(d.d_un.d_val);
+                }
+                if (tag == DT_NULL)
+                    break;
+                if (tag == DT_NEEDED && value < dynstr.size)
+                    info.needed.push_back(strings.data() + value);
+                else if (tag == DT_SONAME && value < dynstr.size)
+                    info.soname = strings.data() + value;
+            }
+            return true;
+        }
+
+        /**
+         * @brief Runs a post-processing tool (strip, objcopy, gzip, ...) with its stdout
+         *        discarded (errors still reach stderr).
+         *
+         * These tools replace files with new inodes, so under fakeroot they run in the
+         * build's session: they copy the faked owner onto the new file, and the
+         * ownership assemble() set survives. Without a shared daemon every call goes
+         * through "fakeroot -i/-s" on the same state file, so those calls are serialized.
+         */
+        static bool runQuietly(std::vector<std::string> argv)
+        {
+            ProcessSpec spec;
+            spec.env = Environment::current();
+            spec.argv = std::move(argv);
+            if (useFakeroot && !fakerootSession.wrap(spec))
+                return false;
+            static std::mutex stateFileMutex;
+            std::unique_lock<std::mutex> lock(stateFileMutex, std::defer_lock);
+            if (useFakeroot && !fakerootSession.active())
+                lock.lock();
+            int nullFd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+            if (nullFd >= 0)
+                spec.fds.push_back({nullFd, STDOUT_FILENO});
+            ProcessResult result;
+            bool ok = runProcess(spec, result) && result.succeeded();
+            if (nullFd >= 0)
+                ::close(nullFd);
+            return ok;
+        }
+
+        /**
+         * @struct TreeEntry
+         * One file, directory or symlink of a PackageInventory.
+         */
+        struct TreeEntry
+        {
+            std::string path;      ///< Relative to the inventory's root
+            std::string extension; ///< Including the dot, empty if none
+            mode_t mode = 0;       ///< lstat() st_mode
+            uint64_t size = 0;     ///< lstat() st_size
+            dev_t dev = 0;
+            ino_t ino = 0;
+            nlink_t nlink = 0;
+            uid_t uid = 0;
+            gid_t gid = 0;
+            bool isElf = false;   ///< A regular file starting with an ELF identification
+            bool removed = false; ///< Deleted by a post-processing step since the scan
+
+            bool isRegular() const { return !removed && S_ISREG(mode); }
+        };
+
+        /**
+         * @class PackageInventory
+         * @brief Everything below a package's files/ directory, read in one pass.
+         *
+         * scan() walks the tree with getdents64() on directory fds opened relative to
+         * the root, fanning out over subdirectories on up to buildJobs threads. Each
+         * entry is lstat()ed once and regular files have their first 16 bytes read to
+         * tell ELF objects apart, so stripping, .la/.a removal and size accounting all
+         * work from this list instead of walking the tree themselves. Steps that change
+         * files update the affected entries (see refresh()).
+         */
+        class PackageInventory
+        {
+        public:
+            const fs::path &root() const { return root_; }
+            std::vector<TreeEntry> &entries() { return entries_; }
+            const std::vector<TreeEntry> &entries() const { return entries_; }
+            fs::path pathOf(const TreeEntry &entry) const { return root_ / entry.path; }
+
+            /**
+             * @brief Scans root. Returns false if root itself cannot be read.
+             */
+            bool scan(const fs::path &root)
+            {
+                TraceSpan span("postprocess", "scan tree");
+                span.arg("root", root.string());
+                auto start = std::chrono::steady_clock::now();
+                root_ = root;
+                entries_.clear();
+                rootFd_ = ::open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (rootFd_ < 0)
+                {
+                    log_error("Could not open " + root.string() + ": " + strerror(errno));
+                    return false;
+                }
+
+                pending_ = {""};
+                busy_ = 0;
+                size_t workers = std::max(1u, buildJobs);
+                std::vector<std::vector<TreeEntry>> found(workers);
+                std::vector<std::thread> threads;
+                for (size_t i = 1; i < workers; ++i)
+                    threads.emplace_back([this, &found, i]
+                                         { work(found[i]); });
+                work(found[0]);
+                for (auto &t : threads)
+                    t.join();
+                ::close(rootFd_);
+                rootFd_ = -1;
+
+                for (auto &part : found)
+                    std::move(part.begin(), part.end(), std::back_inserter(entries_));
+                std::sort(entries_.begin(), entries_.end(),
+                          [](const TreeEntry &a, const TreeEntry &b)
+                          { return a.path < b.path; });
+
+                size_t files = 0, dirs = 0, links = 0, elf = 0;
+                for (const auto &e : entries_)
+                {
+                    files += S_ISREG(e.mode);
+                    dirs += S_ISDIR(e.mode);
+                    links += S_ISLNK(e.mode);
+                    elf += e.isElf;
+                }
+                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+                log_message("Scanned " + root.string() + ": " + std::to_string(files) + " file(s) (" +
+                            std::to_string(elf) + " ELF), " + std::to_string(dirs) + " directories, " +
+                            std::to_string(links) + " symlink(s), " + std::to_string(installedBytes()) +
+                            " bytes (" + std::to_string(ms) + " ms).");
+                return true;
+            }
+
+            /**
+             * @brief Re-reads size, mode and ELF-ness of the entries matching pred, after
+             *        a step rewrote them. Entries that have disappeared are marked removed.
+             */
+            void refresh(const std::function<bool(const TreeEntry &)> &pred)
+            {
+                for (auto &e : entries_)
+                {
+                    if (e.removed || !pred(e))
+                        continue;
+                    struct stat st;
+                    if (::lstat(pathOf(e).c_str(), &st) != 0)
                     {
-                        repoName.erase(repoName.size() - 4);
+                        e.removed = true;
+                        continue;
                     }
+                    fill(e, st);
+                    e.isElf = S_ISREG(st.st_mode) && readsAsElf(AT_FDCWD, pathOf(e).c_str(), st);
+                }
+            }
 
-                    if (std::filesystem::exists(repoName) && !std::filesystem::is_empty(repoName))
-                    {
-                        log_message("Directory '" + repoName + "' already exists; skipping clone...");
-                        intermediatePaths.push_back(repoName);
+            /**
+             * @brief Bytes the package occupies once installed: the size of every regular
+             *        file (hard links counted once) and symlink.
+             */
+            uint64_t installedBytes() const
+            {
+                uint64_t total = 0;
+                std::set<std::pair<dev_t, ino_t>> seen;
+                for (const auto &e : entries_)
+                {
+                    if (e.removed || !(S_ISREG(e.mode) || S_ISLNK(e.mode)))
                         continue;
-                    }
+                    if (e.nlink > 1 && !seen.insert({e.dev, e.ino}).second)
+                        continue;
+                    total += e.size;
+                }
+                return total;
+            }
+
+        private:
+            static void fill(TreeEntry &e, const struct stat &st)
+            {
+                e.mode = st.st_mode;
+                e.size = static_cast<uint64_t>(st.st_size);
+                e.dev = st.st_dev;
+                e.ino = st.st_ino;
+                e.nlink = st.st_nlink;
+                e.uid = st.st_uid;
+                e.gid = st.st_gid;
+            }
+
+            static bool readsAsElf(int dirFd, const char *name, const struct stat &st)
+            {
+                if (st.st_size < EI_NIDENT)
+                    return false;
+                int fd = ::openat(dirFd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+                if (fd < 0)
+                    return false;
+                unsigned char ident[EI_NIDENT];
+                bool elf = ::pread(fd, ident, sizeof(ident), 0) == static_cast<ssize_t>(sizeof(ident)) && hasElfIdent(ident);
+                ::close(fd);
+                return elf;
+            }
 
-                    log_message("Cloning Git repo: " + gitUrl + " => " + repoName);
-                    if (!cloneGitRepo(gitUrl, repoName))
+            // Takes directories off pending_ until the whole tree has been read
+            void work(std::vector<TreeEntry> &out)
+            {
+                tracer.nameThread("scan worker");
+                std::vector<std::string> subdirs;
+                while (true)
+                {
+                    std::string dir;
                     {
-                        return false;
+                        std::unique_lock<std::mutex> lock(mutex_);
+                        cv_.wait(lock, [this]
+                                 { return !pending_.empty() || busy_ == 0; });
+                        if (pending_.empty())
+                            return;
+                        dir = std::move(pending_.back());
+                        pending_.pop_back();
+                        ++busy_;
                     }
-                    intermediatePaths.push_back(repoName);
-                    continue;
+
+                    subdirs.clear();
+                    readDirectory(dir, out, subdirs);
+
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    for (auto &sub : subdirs)
+                        pending_.push_back(std::move(sub));
+                    --busy_;
+                    cv_.notify_all();
                 }
+            }
 
-                // 2) If there's a custom filename in "name::URL" format
-                std::string customFilename;
-                std::string actualUrl;
-                size_t doubleColonPos = src.find("::");
-                if (doubleColonPos != std::string::npos)
+            void readDirectory(const std::string &dir, std::vector<TreeEntry> &out, std::vector<std::string> &subdirs)
+            {
+                int dirFd = ::openat(rootFd_, dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                if (dirFd < 0)
                 {
-                    customFilename = src.substr(0, doubleColonPos);
-                    actualUrl = src.substr(doubleColonPos + 2);
+                    log_warning("Could not read " + (root_ / dir).string() + ": " + strerror(errno));
+                    return;
                 }
-
-                // If we do have a custom name+URL
-                if (!customFilename.empty() && !actualUrl.empty())
+                alignas(struct dirent64) char buf[32768];
+                ssize_t n;
+                while ((n = ::getdents64(dirFd, buf, sizeof(buf))) > 0)
                 {
-                    bool isRemote = (actualUrl.find("://") != std::string::npos);
-                    if (!isRemote)
-                    {
-                        log_error("Invalid custom URL syntax: " + src);
-                        return false;
-                    }
-                    if (!std::filesystem::exists(customFilename))
+                    for (ssize_t off = 0; off < n;)
                     {
-                        log_message("Downloading to custom file name: " + customFilename + " from " + actualUrl);
-                        if (!downloadFile(actualUrl, customFilename))
+                        auto *d = reinterpret_cast<struct dirent64 *>(buf + off);
+                        off += d->d_reclen;
+                        const char *name = d->d_name;
+                        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                            continue;
+                        struct stat st;
+                        if (::fstatat(dirFd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                            continue;
+
+                        TreeEntry e;
+                        e.path = dir.empty() ? std::string(name) : dir + "/" + name;
+                        fill(e, st);
+                        if (S_ISDIR(st.st_mode))
                         {
-                            log_error("Could not download " + actualUrl);
-                            return false;
+                            subdirs.push_back(e.path);
                         }
-                    }
-                    else
-                    {
-                        log_message("File already exists, skipping download: " + customFilename);
-                    }
-                    intermediatePaths.push_back(customFilename);
-                    // Possibly extract if recognized as an archive
-                    if (isArchiveFile(customFilename))
-                    {
-                        if (!extractArchive(customFilename))
+                        else if (S_ISREG(st.st_mode))
                         {
-                            return false;
+                            const char *dot = strrchr(name, '.');
+                            if (dot && dot != name)
+                                e.extension = dot;
+                            e.isElf = readsAsElf(dirFd, name, st);
                         }
+                        out.push_back(std::move(e));
                     }
-                    continue;
                 }
+                if (n < 0)
+                    log_warning("Could not read " + (root_ / dir).string() + ": " + strerror(errno));
+                ::close(dirFd);
+            }
 
-                // 3) Otherwise, normal fallback: check if it's a remote URL or local file
-                bool isURL = (src.find("://") != std::string::npos);
-                std::string filename;
+            fs::path root_;
+            std::vector<TreeEntry> entries_;
+            int rootFd_ = -1;
+            std::mutex mutex_;
+            std::condition_variable cv_;
+            std::vector<std::string> pending_;
+            size_t busy_ = 0;
+        };
 
-                if (isURL)
+        /**
+         * @brief Strips the inventory's ELF objects on a pool of worker threads.
+         *
+         * Each worker takes a batch of the ELF files found by the scan, reads their
+         * section tables (see inspectElf()) and hands only those that still carry a
+         * symbol table or debug sections to a single strip invocation. Scripts, data
+         * files, already stripped objects and *.o files are never passed to strip,
+         * and hard links are stripped only once. The sizes of the stripped files are
+         * updated in the inventory afterwards.
+         *
+         * With a debugRoot (--split-debug), objects with debug sections are not just
+         * stripped: their debug information is first copied with objcopy
+         * --only-keep-debug to debugRoot/usr/lib/debug/.build-id/xx/yyyy.debug (or
+         * usr/lib/debug/<path>.debug without a build id), optionally with compressed
+         * debug sections, and the stripped object gets a .gnu_debuglink to it. Objects
+         * sharing a build id share one .debug file.
+         */
+        static void stripElfFiles(PackageInventory &inventory, const std::string &strip,
+                                  const fs::path &debugRoot = {})
+        {
+            auto start = std::chrono::steady_clock::now();
+            const std::string packagedir = inventory.root().string();
+            std::vector<fs::path> files;
+            size_t regularFiles = 0;
+            std::set<std::pair<dev_t, ino_t>> seen;
+            for (const auto &e : inventory.entries())
+            {
+                if (!e.isRegular())
+                    continue;
+                ++regularFiles;
+                if (!e.isElf || e.extension == ".o")
+                    continue;
+                if (e.nlink > 1 && !seen.insert({e.dev, e.ino}).second)
+                    continue;
+                files.push_back(inventory.pathOf(e));
+            }
+
+            const std::string objcopy = debugRoot.empty() ? "" : findInPath("objcopy");
+            if (!debugRoot.empty() && objcopy.empty())
+                log_warning("objcopy not found; debug information is stripped, not split.");
+
+            // Second and later objects with the same build id wait until its .debug exists
+            std::mutex claimMutex;
+            std::unordered_set<std::string> claimedDebugFiles;
+            std::vector<std::pair<std::string, std::string>> duplicates;
+
+            // Copies the debug information out; the object is then stripped and linked to it
+            enum class Split
+            {
+                Done,
+                Deferred,
+                Failed
+            };
+            auto splitDebugInfo = [&](const fs::path &file, const ElfInfo &info)
+            {
+                fs::path debugFile = debugRoot / "usr/lib/debug";
+                if (info.buildId.size() > 2)
+                    debugFile /= ".build-id/" + info.buildId.substr(0, 2) + "/" + info.buildId.substr(2) + ".debug";
+                else
+                    debugFile /= fs::path(file).lexically_relative(packagedir).string() + ".debug";
                 {
-                    size_t pos = src.find_last_of("/");
-                    filename = (pos != std::string::npos) ? src.substr(pos + 1) : src;
-                    if (filename.empty())
+                    std::lock_guard<std::mutex> lock(claimMutex);
+                    if (!claimedDebugFiles.insert(debugFile.string()).second)
                     {
-                        filename = "source.tar";
+                        duplicates.push_back({file.string(), debugFile.string()});
+                        return Split::Deferred;
                     }
-                    if (!std::filesystem::exists(filename))
+                }
+
+                std::error_code dirEc;
+                fs::create_directories(debugFile.parent_path(), dirEc);
+                std::vector<std::string> keep = {objcopy, "--only-keep-debug"};
+                if (!debugCompression.empty())
+                    keep.push_back("--compress-debug-sections=" + debugCompression);
+                keep.insert(keep.end(), {file.string(), debugFile.string()});
+                if (!runQuietly(keep))
+                {
+                    fs::remove(debugFile, dirEc);
+                    return Split::Failed;
+                }
+                ::chmod(debugFile.c_str(), 0644);
+                return runQuietly({objcopy, "--strip-unneeded", "--add-gnu-debuglink=" + debugFile.string(), file.string()})
+                           ? Split::Done
+                           : Split::Failed;
+            };
+
+            constexpr size_t kBatchSize = 64;
+            std::atomic<size_t> next{0};
+            std::atomic<size_t> elfCount{0}, strippedCount{0}, splitCount{0}, failedCount{0};
+            auto worker = [&]
+            {
+                tracer.nameThread("strip worker");
+                std::vector<std::string> batch;
+                size_t begin;
+                while ((begin = next.fetch_add(kBatchSize)) < files.size())
+                {
+                    size_t end = std::min(files.size(), begin + kBatchSize);
+                    batch.clear();
+                    for (size_t i = begin; i < end; ++i)
                     {
-                        if (!downloadFile(src, filename))
+                        ElfInfo info;
+                        if (!inspectElf(files[i], info) || !info.isElf)
+                            continue;
+                        ++elfCount;
+                        if (!info.hasSymbols)
+                            continue;
+                        if (info.hasDebug && !objcopy.empty())
                         {
-                            log_error("Could not download " + src);
-                            return false;
+                            TraceSpan span("postprocess", "split debug");
+                            Split split = splitDebugInfo(files[i], info);
+                            if (split == Split::Deferred)
+                                continue;
+                            if (split == Split::Done)
+                            {
+                                ++strippedCount;
+                                ++splitCount;
+                                continue;
+                            }
+                            log_warning("Could not split the debug information of " + files[i].string() + "; stripping it.");
                         }
+                        batch.push_back(files[i].string());
+                    }
+                    if (batch.empty())
+                        continue;
+
+                    TraceSpan span("postprocess", "strip batch");
+                    std::vector<std::string> argv = {strip, "--strip-unneeded"};
+                    argv.insert(argv.end(), batch.begin(), batch.end());
+                    if (runQuietly(argv))
+                    {
+                        strippedCount += batch.size();
                     }
                     else
                     {
-                        log_message("File already exists, skipping download: " + filename);
+                        failedCount += batch.size();
+                        log_warning("strip failed on a batch of " + std::to_string(batch.size()) +
+                                    " file(s) starting with " + batch.front());
                     }
                 }
+            };
+
+            size_t workers = std::min<size_t>(std::max(1u, buildJobs), (files.size() + kBatchSize - 1) / kBatchSize);
+            std::vector<std::thread> threads;
+            for (size_t i = 1; i < workers; ++i)
+                threads.emplace_back(worker);
+            worker();
+            for (auto &t : threads)
+                t.join();
+
+            for (const auto &[file, debugFile] : duplicates)
+            {
+                std::error_code existsEc;
+                bool ok = fs::exists(debugFile, existsEc)
+                              ? runQuietly({objcopy, "--strip-unneeded", "--add-gnu-debuglink=" + debugFile, file})
+                              : runQuietly({strip, "--strip-unneeded", file});
+                ++(ok ? strippedCount : failedCount);
+                if (ok && fs::exists(debugFile, existsEc))
+                    ++splitCount;
+            }
+
+            inventory.refresh([](const TreeEntry &e)
+                              { return e.isElf; });
+
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            log_message("Stripped " + std::to_string(strippedCount.load()) + " of " + std::to_string(elfCount.load()) +
+                        " ELF file(s) among " + std::to_string(regularFiles) + " file(s) in " + packagedir + " (" +
+                        std::to_string(ms) + " ms, " + std::to_string(std::max<size_t>(1, workers)) + " worker(s))" +
+                        (debugRoot.empty() ? "" : ", " + std::to_string(splitCount.load()) + " with split debug information") +
+                        (failedCount ? "; " + std::to_string(failedCount.load()) + " could not be stripped." : "."));
+        }
+
+        /**
+         * @struct ManCompressor
+         * A compressor postProcessFiles() can use for man and info pages.
+         */
+        struct ManCompressor
+        {
+            const char *name;
+            const char *extension;
+            std::vector<std::string> args; ///< Compress the named files in place, replacing them
+        };
+
+        /**
+         * @brief Looks up a man page compression format ("gzip", "xz", "zstd", "bzip2").
+         *        Returns nullptr for "none" and unknown names.
+         */
+        static const ManCompressor *findManCompressor(const std::string &name)
+        {
+            static const std::vector<ManCompressor> compressors = {
+                {"gzip", ".gz", {"-9", "-n", "-f"}},
+                {"xz", ".xz", {"-f"}},
+                {"zstd", ".zst", {"-q", "-f", "--rm", "-19"}},
+                {"bzip2", ".bz2", {"-f", "-9"}},
+            };
+            for (const auto &c : compressors)
+                if (name == c.name)
+                    return &c;
+            return nullptr;
+        }
+
+        /**
+         * @brief Compresses the man and info pages in the inventory and fixes up the
+         *        symlinks pointing at them.
+         *
+         * Regular files below usr/share/man and usr/share/info (except the info "dir"
+         * index and pages that are already compressed) are compressed in batches on
+         * buildJobs threads, one name per inode; further hard links are re-created to
+         * the compressed file. Symlinks to a page that was compressed have their target
+         * adjusted, and inside those directories also get the extension added to their
+         * name. Doc-dir symlinks to pages outside the package are treated the same way.
+         */
+        static void compressManPages(PackageInventory &inventory, const ManCompressor &compressor)
+        {
+            static const std::unordered_set<std::string> compressedExtensions = {".gz", ".xz", ".zst", ".bz2", ".lzma", ".Z"};
+            auto isDocPath = [](const std::string &path)
+            {
+                return path.rfind("usr/share/man/", 0) == 0 || path.rfind("usr/share/info/", 0) == 0;
+            };
+
+            auto &entries = inventory.entries();
+            std::vector<size_t> pages;
+            std::map<std::pair<dev_t, ino_t>, std::vector<size_t>> extraLinks;
+            std::map<std::pair<dev_t, ino_t>, size_t> firstLink;
+            for (size_t i = 0; i < entries.size(); ++i)
+            {
+                const auto &e = entries[i];
+                if (!e.isRegular() || !isDocPath(e.path) || compressedExtensions.count(e.extension) ||
+                    e.path == "usr/share/info/dir")
+                    continue;
+                auto [it, first] = firstLink.insert({{e.dev, e.ino}, i});
+                if (first)
+                    pages.push_back(i);
                 else
+                    extraLinks[{e.dev, e.ino}].push_back(i);
+            }
+            if (pages.empty())
+                return;
+
+            std::string tool = findInPath(compressor.name);
+            if (tool.empty())
+            {
+                log_warning(std::string(compressor.name) + " not found; man and info pages are left uncompressed.");
+                return;
+            }
+
+            TraceSpan span("postprocess", "compress man pages");
+            auto start = std::chrono::steady_clock::now();
+            const std::string ext = compressor.extension;
+            std::vector<char> done(pages.size(), 0);
+            constexpr size_t kBatchSize = 32;
+            std::atomic<size_t> next{0};
+            auto worker = [&]
+            {
+                size_t begin;
+                while ((begin = next.fetch_add(kBatchSize)) < pages.size())
                 {
-                    // local file
-                    std::filesystem::path srcPath = starbuildDir / src;
-                    if (!std::filesystem::exists(srcPath))
-                    {
-                        log_error("Local source file does not exist: " + srcPath.string());
-                        return false;
-                    }
-                    filename = srcPath.filename().string();
-                    if (!std::filesystem::exists(filename))
+                    size_t end = std::min(pages.size(), begin + kBatchSize);
+                    std::vector<std::string> argv = {tool};
+                    argv.insert(argv.end(), compressor.args.begin(), compressor.args.end());
+                    for (size_t i = begin; i < end; ++i)
+                        argv.push_back(inventory.pathOf(entries[pages[i]]).string());
+                    runQuietly(argv);
+                    // A failing batch may still have compressed part of its files
+                    for (size_t i = begin; i < end; ++i)
                     {
-                        try
-                        {
-                            std::filesystem::copy_file(srcPath, filename,
-                                                       std::filesystem::copy_options::overwrite_existing);
-                            log_message("Copied local file: " + filename);
-                        }
-                        catch (std::filesystem::filesystem_error &e)
-                        {
-                            log_error(std::string("Failed to copy local file: ") + e.what());
-                            return false;
-                        }
+                        struct stat st;
+                        fs::path compressed = inventory.pathOf(entries[pages[i]]).string() + ext;
+                        done[i] = ::lstat(compressed.c_str(), &st) == 0 && S_ISREG(st.st_mode);
                     }
-                    else
+                }
+            };
+            size_t workers = std::min<size_t>(std::max(1u, buildJobs), (pages.size() + kBatchSize - 1) / kBatchSize);
+            std::vector<std::thread> threads;
+            for (size_t i = 1; i < workers; ++i)
+                threads.emplace_back(worker);
+            worker();
+            for (auto &t : threads)
+                t.join();
+
+            // Entries renamed so far, by their old path
+            std::unordered_set<std::string> renamed;
+            size_t count = 0;
+            for (size_t p = 0; p < pages.size(); ++p)
+            {
+                auto &e = entries[pages[p]];
+                if (!done[p])
+                {
+                    log_warning("Could not compress " + inventory.pathOf(e).string());
+                    continue;
+                }
+                const fs::path compressed = inventory.pathOf(e).string() + ext;
+                auto links = extraLinks.find({e.dev, e.ino});
+                renamed.insert(e.path);
+                e.path += ext;
+                e.extension = ext;
+                ++count;
+                if (links == extraLinks.end())
+                    continue;
+                for (size_t l : links->second)
+                {
+                    auto &link = entries[l];
+                    fs::path path = inventory.pathOf(link);
+                    fs::path newPath = path.string() + ext;
+                    if (::unlink(path.c_str()) != 0 || ::link(compressed.c_str(), newPath.c_str()) != 0)
                     {
-                        log_message("Local file already present: " + filename);
+                        log_warning("Could not re-create hard link " + newPath.string() + ": " + strerror(errno));
+                        link.removed = true;
+                        continue;
                     }
+                    renamed.insert(link.path);
+                    link.path += ext;
+                    link.extension = ext;
                 }
+            }
 
-                intermediatePaths.push_back(filename);
-                if (isArchiveFile(filename))
+            // Symlinks: inside the doc directories they follow the pages' naming, so
+            // chains of links are handled by repeating until nothing changes
+            size_t relinked = 0;
+            for (bool changed = true; changed;)
+            {
+                changed = false;
+                for (auto &e : entries)
                 {
-                    if (!extractArchive(filename))
+                    if (e.removed || !S_ISLNK(e.mode) || renamed.count(e.path))
+                        continue;
+                    fs::path path = inventory.pathOf(e);
+                    std::error_code ec;
+                    fs::path target = fs::read_symlink(path, ec);
+                    if (ec || compressedExtensions.count(target.extension().string()) || fs::is_directory(path, ec))
+                        continue;
+                    fs::path resolved = target.is_absolute() ? target.relative_path()
+                                                             : (fs::path(e.path).parent_path() / target).lexically_normal();
+                    // Only links to pages compressed here are renamed. A doc-dir link
+                    // whose target is not in this package is assumed to point at another
+                    // package's page, which is compressed the same way.
+                    bool inDocDir = isDocPath(e.path);
+                    struct stat st;
+                    bool inPackage = *resolved.begin() != ".." &&
+                                     ::lstat((inventory.root() / resolved).c_str(), &st) == 0;
+                    if ((!inDocDir || inPackage) && !renamed.count(resolved.string()))
+                        continue;
+
+                    fs::path newPath = inDocDir ? fs::path(path.string() + ext) : path;
+                    fs::path tmp = path.string() + ".starpack-link";
+                    if (::symlink((target.string() + ext).c_str(), tmp.c_str()) != 0 ||
+                        ::rename(tmp.c_str(), newPath.c_str()) != 0 ||
+                        (inDocDir && ::unlink(path.c_str()) != 0))
                     {
-                        return false;
+                        log_warning("Could not update symlink " + path.string() + ": " + strerror(errno));
+                        ::unlink(tmp.c_str());
+                        continue;
+                    }
+                    if (inDocDir)
+                    {
+                        renamed.insert(e.path);
+                        e.path += ext;
                     }
+                    ++relinked;
+                    changed = true;
                 }
             }
 
-            return true;
+            inventory.refresh([&ext](const TreeEntry &e)
+                              { return e.extension == ext || S_ISLNK(e.mode); });
+
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            log_message("Compressed " + std::to_string(count) + " man/info page(s) with " + compressor.name + " and updated " +
+                        std::to_string(relinked) + " symlink(s) (" + std::to_string(ms) + " ms, " +
+                        std::to_string(std::max<size_t>(1, workers)) + " worker(s)).");
         }
 
         /**
-         * @brief runWithBash: Invokes /bin/bash -c '...' optionally under fakeroot.
+         * @brief postProcessFiles:
+         *        - Compresses man and info pages (see compressManPages(); unless manCompressor is null)
+         *        - Strips unneeded symbols from ELF objects (see stripElfFiles(); unless noStripping is true)
+         *        - Removes .la and .a files
          *
-         * Sets environment variables: pkgdir, packagedir, srcdir, package_name, package_version.
-         * Accepts a shell script body as a string. If the script is empty, does nothing.
+         * Called after the subpackage's "assemble" script completes. If `noStripping`
+         * is set, stripping and .la/.a removal are skipped. Works from the inventory
+         * scanned after assemble and keeps it up to date, so the tree is not walked again.
          *
-         * @param script The shell script content to run.
-         * @param pkg_packagedir The "files/" directory for the subpackage or single package
-         * @param srcdir The directory containing STARBUILD and any local source files
-         * @param package_name The subpackage or single package name
-         * @param package_version The package version
-         * @return True if script returns 0, false otherwise.
+         * @param inventory The scanned "files/" directory of the subpackage.
+         * @param debugdir If set, debug information is split into this tree instead of
+         *        being thrown away (see stripElfFiles()).
+         * @param manCompressor Compression for man and info pages, or nullptr to leave them as they are.
+         * @return True on success (including if noStripping is enabled), false otherwise.
          */
-        static bool runWithBash(const std::string &script,
-                                const std::string &pkg_packagedir,
-                                const std::string &srcdir,
-                                const std::string &package_name,
-                                const std::string &package_version,
-                                const std::vector<std::string> &customFuncs)
+        static bool postProcessFiles(PackageInventory &inventory, const fs::path &debugdir = {},
+                                     const ManCompressor *manCompressor = nullptr)
         {
-            // Nothing to do if there's no script body
-            if (script.empty() && customFuncs.empty())
-                return true;
+            // 1) Compressing man and info pages
+            if (manCompressor)
+                compressManPages(inventory, *manCompressor);
 
-            // 1) Combine helper‐function definitions + the real script
-            std::string fullScript;
-            for (auto const &fnDef : customFuncs)
+            if (noStripping)
             {
-                fullScript += fnDef;
-                if (fnDef.back() != '\n')
-                    fullScript += "\n";
+                log_message("nostripping flag enabled; skipping binary stripping and .la/.a removal.");
+                return true; // proceed, no error
             }
-            fullScript += script;
+            const std::string packagedir = inventory.root().string();
+            TraceSpan span("postprocess", "postProcessFiles");
+            span.arg("packagedir", packagedir);
 
-            // 2) Escape single quotes for safe embedding in bash -c '…'
-            std::string escaped;
-            escaped.reserve(fullScript.size() * 2);
-            for (char c : fullScript)
+            // 2) Stripping ELF binaries
+            std::string strip = findInPath("strip");
+            if (strip.empty())
             {
-                if (c == '\'')
-                    escaped += R"('\'' )"; // end-quote, escaped-quote, reopen
-                else
-                    escaped += c;
+                // No 'strip' available, warn but don't fail
+                log_warning("'strip' command not found. Binaries won't be stripped.");
+            }
+            else
+            {
+                TraceSpan stripSpan("postprocess", "strip");
+                log_message("Stripping binaries in " + packagedir + "...");
+                stripElfFiles(inventory, strip, debugdir);
+            }
+
+            // 3) Remove .la and .a files
+            TraceSpan laSpan("postprocess", "remove .la/.a");
+            for (const char *extension : {".la", ".a"})
+            {
+                bool removed = false;
+                for (auto &e : inventory.entries())
+                {
+                    if (!e.isRegular() || e.extension != extension)
+                        continue;
+                    fs::path path = inventory.pathOf(e);
+                    log_message("Removing " + path.string());
+                    std::error_code ec_remove;
+                    if (!fs::remove(path, ec_remove) && ec_remove)
+                    {
+                        log_warning("Failed to remove " + std::string(extension) + " file " + path.string() + ": " +
+                                    ec_remove.message());
+                    }
+                    else
+                    {
+                        e.removed = true;
+                        removed = true;
+                    }
+                }
+                if (!removed)
+                {
+                    log_message("No " + std::string(extension) + " files found in " + packagedir + ".");
+                }
             }
 
-            // 3) Build the environment+command string
-            std::string prefix = useFakeroot ? "fakeroot " : "";
-            std::ostringstream cmd;
-            cmd << prefix << "/bin/bash -c '"
-                << "export pkgdir=\"" << pkg_packagedir << "\" && "
-                << "export packagedir=\"" << pkg_packagedir << "\" && "
-                << "export srcdir=\"" << srcdir << "\" && "
-                << "export package_name=\"" << package_name << "\" && "
-                << "export package_version=\"" << package_version << "\" && "
-                << escaped
-                << "'";
+            return true; // Non-fatal if it can't strip or remove .la/.a
+        }
 
-            // 4) Execute
-            int ret = std::system(cmd.str().c_str());
-            return (ret == 0);
+        /**
+         * @brief Reads the owner of every regular file below root as the fakeroot
+         *        session reports it, i.e. the ownership assemble() gave it.
+         *
+         * One find(1) runs inside the session and prints device, inode, uid and gid.
+         */
+        static bool readFakedOwners(const fs::path &root,
+                                    std::map<std::pair<dev_t, ino_t>, std::pair<uid_t, gid_t>> &owners)
+        {
+            std::string find = findInPath("find");
+            FILE *out = std::tmpfile();
+            if (find.empty() || !out)
+            {
+                if (out)
+                    std::fclose(out);
+                return false;
+            }
+            ProcessSpec spec;
+            spec.env = Environment::current();
+            spec.argv = {find, root.string(), "-type", "f", "-printf", "%D %i %U %G\n"};
+            spec.fds.push_back({fileno(out), STDOUT_FILENO});
+            ProcessResult result;
+            bool ok = fakerootSession.wrap(spec) && runProcess(spec, result) && result.succeeded();
+            std::rewind(out);
+            unsigned long long dev, ino;
+            unsigned long uid, gid;
+            while (ok && std::fscanf(out, "%llu %llu %lu %lu", &dev, &ino, &uid, &gid) == 4)
+                owners[{static_cast<dev_t>(dev), static_cast<ino_t>(ino)}] = {static_cast<uid_t>(uid), static_cast<gid_t>(gid)};
+            std::fclose(out);
+            return ok;
         }
 
         /**
-         * @brief postProcessFiles:
-         *        - Strips unneeded symbols from binaries (unless noStripping is true)
-         *        - Removes .la and .a files
+         * @brief Replaces byte-identical files in the inventory with hard links to one copy.
          *
-         * Called after the subpackage's "assemble" script completes. If `noStripping`
-         * is set, the entire step is skipped.
+         * Candidates are grouped by size (and by mode and owner, which links share),
+         * groups of two or more are hashed on buildJobs threads, and files with equal
+         * hashes are compared byte for byte before a duplicate is swapped for a link.
+         * tar then stores the copies as link entries, so both the archive and the
+         * installed package shrink. Files that already share an inode count once.
          *
-         * @param packagedir The subpackage directory containing "files/" for the build.
-         * @return True on success (including if noStripping is enabled), false otherwise.
+         * Under fakeroot the owner is the one the session reports (see
+         * readFakedOwners()). Files below etc/ are configuration the user may edit and
+         * are never linked together.
+         *
+         * @return The number of bytes saved.
          */
-        static bool postProcessFiles(const std::string &packagedir)
+        static uint64_t hardlinkDuplicates(PackageInventory &inventory)
         {
-            if (noStripping)
+            TraceSpan span("postprocess", "hardlink duplicates");
+            auto start = std::chrono::steady_clock::now();
+
+            std::map<std::pair<dev_t, ino_t>, std::pair<uid_t, gid_t>> fakedOwners;
+            if (useFakeroot && !readFakedOwners(inventory.root(), fakedOwners))
             {
-                log_message("nostripping flag enabled; skipping binary stripping and .la/.a removal.");
-                return true; // proceed, no error
+                log_warning("Could not read file ownership from the fakeroot session; not deduplicating " +
+                            inventory.root().string() + ".");
+                return 0;
             }
 
-            // 1) Stripping ELF binaries
-            int ret = std::system("command -v strip > /dev/null 2>&1");
-            if (ret != 0)
+            // One representative per inode
+            struct Inode
             {
-                // No 'strip' available, warn but don't fail
-                log_warning("'strip' command not found. Binaries won't be stripped.");
+                size_t entry;
+                uint64_t size;
+                size_t hash = 0;
+            };
+            std::vector<Inode> inodes;
+            std::set<std::pair<dev_t, ino_t>> seen;
+            auto &entries = inventory.entries();
+            for (size_t i = 0; i < entries.size(); ++i)
+            {
+                const auto &e = entries[i];
+                if (e.isRegular() && e.size > 0 && e.path.rfind("etc/", 0) != 0 && seen.insert({e.dev, e.ino}).second)
+                    inodes.push_back({i, e.size});
             }
-            else
+
+            std::map<std::tuple<uint64_t, mode_t, uid_t, gid_t>, std::vector<size_t>> bySize;
+            for (size_t i = 0; i < inodes.size(); ++i)
             {
-                log_message("Stripping binaries in " + packagedir + "...");
-                // Use 'find' to locate candidates and strip them.
-                std::string stripCmd =
-                    "find " + packagedir +
-                    R"( -type f ! -name '*.o' -exec strip --strip-unneeded --strip-debug {} + )"
-                    " > /dev/null 2>&1";
-                ret = std::system(stripCmd.c_str());
-                if (ret != 0)
+                const auto &e = entries[inodes[i].entry];
+                std::pair<uid_t, gid_t> owner = {e.uid, e.gid};
+                if (useFakeroot)
                 {
-                    log_warning("Strip command returned non-zero exit code " + std::to_string(ret) + "; check logs for potential errors.");
+                    auto it = fakedOwners.find({e.dev, e.ino});
+                    if (it == fakedOwners.end())
+                        continue; // unknown owner: leave it alone
+                    owner = it->second;
                 }
-                else
+                bySize[{e.size, e.mode, owner.first, owner.second}].push_back(i);
+            }
+            std::vector<size_t> toHash;
+            for (const auto &[key, group] : bySize)
+                if (group.size() > 1)
+                    toHash.insert(toHash.end(), group.begin(), group.end());
+            if (toHash.empty())
+                return 0;
+
+            // Small files are read, larger ones mapped
+            constexpr size_t kReadLimit = 64 * 1024;
+            struct Contents
+            {
+                std::string buffer;
+                void *data = MAP_FAILED;
+                size_t size = 0;
+                bool valid = false;
+                explicit Contents(const fs::path &path, size_t length) : size(length)
+                {
+                    int fd = ::open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+                    if (fd < 0)
+                        return;
+                    if (size <= kReadLimit)
+                    {
+                        buffer.resize(size);
+                        valid = ::pread(fd, buffer.data(), size, 0) == static_cast<ssize_t>(size);
+                    }
+                    else
+                    {
+                        data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                        valid = data != MAP_FAILED;
+                        if (valid)
+                            ::madvise(data, size, MADV_SEQUENTIAL);
+                    }
+                    ::close(fd);
+                }
+                ~Contents()
                 {
-                    log_message("Finished stripping binaries for " + packagedir + ".");
+                    if (data != MAP_FAILED)
+                        ::munmap(data, size);
                 }
-            }
+                bool ok() const { return valid; }
+                std::string_view view() const
+                {
+                    return data != MAP_FAILED ? std::string_view(static_cast<const char *>(data), size) : buffer;
+                }
+            };
 
-            // 2) Remove .la files
-            try
+            std::atomic<size_t> next{0};
+            auto worker = [&]
+            {
+                size_t i;
+                while ((i = next.fetch_add(1)) < toHash.size())
+                {
+                    Inode &inode = inodes[toHash[i]];
+                    Contents map(inventory.pathOf(entries[inode.entry]), inode.size);
+                    inode.hash = map.ok() ? std::hash<std::string_view>{}(map.view()) : 0;
+                }
+            };
+            size_t workers = std::min<size_t>(std::max(1u, buildJobs), toHash.size());
+            std::vector<std::thread> threads;
+            for (size_t i = 1; i < workers; ++i)
+                threads.emplace_back(worker);
+            worker();
+            for (auto &t : threads)
+                t.join();
+
+            std::map<std::pair<dev_t, ino_t>, std::vector<size_t>> linksOf;
+            for (size_t i = 0; i < entries.size(); ++i)
+                if (entries[i].isRegular() && entries[i].nlink > 1)
+                    linksOf[{entries[i].dev, entries[i].ino}].push_back(i);
+            auto pathsOf = [&](size_t entry)
+            {
+                auto it = linksOf.find({entries[entry].dev, entries[entry].ino});
+                return it != linksOf.end() ? it->second : std::vector<size_t>{entry};
+            };
+
+            uint64_t saved = 0;
+            size_t linked = 0;
+            std::set<std::pair<dev_t, ino_t>> touched;
+            for (const auto &[key, group] : bySize)
             {
-                bool removed_la = false;
-                for (const auto &p : fs::recursive_directory_iterator(
-                         packagedir, fs::directory_options::skip_permission_denied))
+                if (group.size() < 2)
+                    continue;
+                std::unordered_map<size_t, std::vector<size_t>> byHash;
+                for (size_t i : group)
+                    byHash[inodes[i].hash].push_back(i);
+                for (auto &[hash, candidates] : byHash)
                 {
-                    std::error_code ec_stat;
-                    auto status = fs::symlink_status(p.path(), ec_stat);
-                    if (!ec_stat && fs::is_regular_file(status) && p.path().extension() == ".la")
+                    // Every distinct content among the candidates keeps its first copy
+                    std::vector<size_t> keepers;
+                    for (size_t i : candidates)
                     {
-                        log_message("Removing " + p.path().string());
-                        std::error_code ec_remove;
-                        if (!fs::remove(p.path(), ec_remove) && ec_remove)
+                        const TreeEntry &dup = entries[inodes[i].entry];
+                        Contents dupMap(inventory.pathOf(dup), dup.size);
+                        size_t keeper = SIZE_MAX;
+                        for (size_t k : keepers)
                         {
-                            log_warning("Failed to remove .la file " + p.path().string() + ": " + ec_remove.message());
+                            const TreeEntry &keep = entries[inodes[k].entry];
+                            Contents keepMap(inventory.pathOf(keep), keep.size);
+                            if (dupMap.ok() && keepMap.ok() && dupMap.view() == keepMap.view())
+                            {
+                                keeper = k;
+                                break;
+                            }
                         }
-                        else
+                        if (keeper == SIZE_MAX)
+                        {
+                            keepers.push_back(i);
+                            continue;
+                        }
+
+                        // Swap every link of the duplicate inode for a link to the keeper
+                        const TreeEntry &keep = entries[inodes[keeper].entry];
+                        const fs::path target = inventory.pathOf(keep);
+                        touched.insert({keep.dev, keep.ino});
+                        bool all = true;
+                        for (size_t l : pathsOf(inodes[i].entry))
                         {
-                            removed_la = true;
+                            fs::path path = inventory.pathOf(entries[l]);
+                            fs::path tmp = path;
+                            tmp += ".starpack-link";
+                            if (::link(target.c_str(), tmp.c_str()) != 0 || ::rename(tmp.c_str(), path.c_str()) != 0)
+                            {
+                                log_warning("Could not hard-link " + path.string() + " to " + target.string() + ": " +
+                                            strerror(errno));
+                                ::unlink(tmp.c_str());
+                                all = false;
+                                continue;
+                            }
+                            entries[l].dev = keep.dev;
+                            entries[l].ino = keep.ino;
+                            ++linked;
                         }
+                        if (all)
+                            saved += dup.size;
                     }
                 }
-                if (!removed_la)
-                {
-                    log_message("No .la files found in " + packagedir + ".");
-                }
             }
-            catch (const fs::filesystem_error &e)
+
+            // Link counts changed for every inode touched above
+            inventory.refresh([&touched](const TreeEntry &e)
+                              { return touched.count({e.dev, e.ino}) > 0; });
+
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            if (linked > 0)
+                log_message("Replaced " + std::to_string(linked) + " duplicate file(s) in " + inventory.root().string() +
+                            " with hard links, saving " + std::to_string(saved) + " bytes (" + std::to_string(ms) + " ms).");
+            else
+                log_message("No duplicate files found in " + inventory.root().string() + ".");
+            return saved;
+        }
+
+        /**
+         * @class SonameResolver
+         * @brief Finds sonames in the build system's library directories, remembering
+         *        each answer for the rest of the build.
+         *
+         * The directories are /lib, /lib64, /usr/lib, /usr/lib64 and those listed in
+         * /etc/ld.so.conf (following its include lines).
+         */
+        class SonameResolver
+        {
+        public:
+            /**
+             * @brief Path of the library with this soname, or empty if there is none.
+             */
+            const std::string &find(const std::string &soname)
             {
-                log_error("Error while removing .la files: " + std::string(e.what()));
+                auto it = cache_.find(soname);
+                if (it != cache_.end())
+                    return it->second;
+                if (dirs_.empty())
+                    loadDirectories();
+                std::string found;
+                for (const auto &dir : dirs_)
+                {
+                    std::string candidate = dir + "/" + soname;
+                    if (::access(candidate.c_str(), F_OK) == 0)
+                    {
+                        found = candidate;
+                        break;
+                    }
+                }
+                return cache_.emplace(soname, std::move(found)).first->second;
             }
 
-            // 3) Remove .a files
-            try
+        private:
+            void loadDirectories()
             {
-                bool removed_a = false;
-                for (const auto &p : fs::recursive_directory_iterator(
-                         packagedir, fs::directory_options::skip_permission_denied))
+                dirs_ = {"/lib", "/lib64", "/usr/lib", "/usr/lib64"};
+                std::vector<std::string> files = {"/etc/ld.so.conf"};
+                for (size_t i = 0; i < files.size() && i < 256; ++i)
                 {
-                    std::error_code ec_stat;
-                    auto status = fs::symlink_status(p.path(), ec_stat);
-                    if (!ec_stat && fs::is_regular_file(status) && p.path().extension() == ".a")
+                    std::ifstream in(files[i]);
+                    std::string line;
+                    while (std::getline(in, line))
                     {
-                        log_message("Removing " + p.path().string());
-                        std::error_code ec_remove;
-                        if (!fs::remove(p.path(), ec_remove) && ec_remove)
+                        line = line.substr(0, line.find('#'));
+                        line.erase(0, line.find_first_not_of(" \t"));
+                        line.erase(line.find_last_not_of(" \t\r") + 1);
+                        if (line.rfind("include", 0) == 0 && line.size() > 7 && isspace(static_cast<unsigned char>(line[7])))
                         {
-                            log_warning("Failed to remove .a file " + p.path().string() + ": " + ec_remove.message());
+                            std::string pattern = line.substr(8);
+                            pattern.erase(0, pattern.find_first_not_of(" \t"));
+                            if (!pattern.empty() && pattern[0] != '/')
+                                pattern = fs::path(files[i]).parent_path().string() + "/" + pattern;
+                            glob_t g;
+                            if (::glob(pattern.c_str(), 0, nullptr, &g) == 0)
+                                files.insert(files.end(), g.gl_pathv, g.gl_pathv + g.gl_pathc);
+                            ::globfree(&g);
                         }
-                        else
+                        else if (!line.empty() && line[0] == '/' &&
+                                 std::find(dirs_.begin(), dirs_.end(), line) == dirs_.end())
                         {
-                            removed_a = true;
+                            dirs_.push_back(line);
                         }
                     }
                 }
-                if (!removed_a)
+            }
+
+            std::vector<std::string> dirs_;
+            std::unordered_map<std::string, std::string> cache_;
+        };
+
+        static SonameResolver sonameResolver;
+
+        /**
+         * @struct SharedLibraries
+         * Sonames a package provides and needs, as found by scanSharedLibraries().
+         */
+        struct SharedLibraries
+        {
+            std::set<std::string> provides; ///< DT_SONAME of the package's shared objects
+            std::set<std::string> needs;    ///< DT_NEEDED entries not provided by the package itself
+        };
+
+        /**
+         * @brief Reads the dynamic sections of the inventory's ELF objects on buildJobs
+         *        threads (see inspectElf()).
+         *
+         * Detached debug files below usr/lib/debug are skipped. Needed sonames that
+         * neither the package nor the build system provides are reported, with the
+         * lookups shared by all packages of the build (see SonameResolver).
+         */
+        static SharedLibraries scanSharedLibraries(const PackageInventory &inventory)
+        {
+            TraceSpan span("postprocess", "shared libraries");
+            auto start = std::chrono::steady_clock::now();
+            std::vector<const TreeEntry *> objects;
+            std::set<std::pair<dev_t, ino_t>> seen;
+            for (const auto &e : inventory.entries())
+            {
+                if (e.isRegular() && e.isElf && e.path.rfind("usr/lib/debug/", 0) != 0 &&
+                    (e.nlink < 2 || seen.insert({e.dev, e.ino}).second))
+                    objects.push_back(&e);
+            }
+
+            SharedLibraries result;
+            std::mutex resultMutex;
+            std::atomic<size_t> next{0};
+            auto worker = [&]
+            {
+                SharedLibraries local;
+                size_t i;
+                while ((i = next.fetch_add(1)) < objects.size())
                 {
-                    log_message("No .a files found in " + packagedir + ".");
+                    ElfInfo info;
+                    if (!inspectElf(inventory.pathOf(*objects[i]), info, true))
+                        continue;
+                    if (!info.soname.empty())
+                        local.provides.insert(info.soname);
+                    local.needs.insert(info.needed.begin(), info.needed.end());
                 }
-            }
-            catch (const fs::filesystem_error &e)
+                std::lock_guard<std::mutex> lock(resultMutex);
+                result.provides.merge(local.provides);
+                result.needs.merge(local.needs);
+            };
+            size_t workers = std::min<size_t>(std::max(1u, buildJobs), objects.size());
+            std::vector<std::thread> threads;
+            for (size_t i = 1; i < workers; ++i)
+                threads.emplace_back(worker);
+            worker();
+            for (auto &t : threads)
+                t.join();
+
+            for (const auto &soname : result.provides)
+                result.needs.erase(soname);
+            for (const auto &soname : result.needs)
             {
-                log_error("Error while removing .a files: " + std::string(e.what()));
+                if (sonameResolver.find(soname).empty())
+                    log_warning(soname + " is needed by " + inventory.root().string() +
+                                " but not provided by it or found on this system.");
             }
 
-            return true; // Non-fatal if it can't strip or remove .la/.a
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            log_message("Shared libraries in " + inventory.root().string() + ": " + std::to_string(result.provides.size()) +
+                        " provided, " + std::to_string(result.needs.size()) + " needed (" + std::to_string(objects.size()) +
+                        " ELF file(s), " + std::to_string(ms) + " ms).");
+            return result;
         }
 
         /**
@@ -1321,6 +7442,7 @@ namespace Starpack
          * @param symlinkPairs     Any symlinks to be created in packagedir prior to tar.
          * @param pkgName          The name of the subpackage (or single package).
          * @param singlePackage    True if there's only one package in the build.
+         * @param usage            If given, receives the combined wall time and rusage of tar and zstd.
          * @return True on success, false otherwise.
          */
         bool packageStarpack(const std::string &starbuildDirStr,
@@ -1329,8 +7451,12 @@ namespace Starpack
                              const std::string &outputFile,
                              const std::vector<std::pair<std::string, std::string>> &symlinkPairs,
                              const std::string &pkgName,
-                             bool singlePackage)
+                             bool singlePackage,
+                             ProcessResult *usage = nullptr)
         {
+            TraceSpan span("package", "packageStarpack");
+            span.arg("package", pkgName);
+
             // 1) Write metadata.yaml into packagedir
             fs::path metaPath = fs::path(packagedir) / "metadata.yaml";
             try
@@ -1376,30 +7502,82 @@ namespace Starpack
             }
 
             // 4) Use tar & zstd to produce the final .starpack
-            //    Transform paths so that leading "./" => "files/", except for metadata.yaml => "metadata.yaml"
-            auto shellEscape = [](const std::string &path)
+            //    Transform paths so that leading "./" => "files/", except for metadata.yaml => "metadata.yaml".
+            //    tar runs in the build's fakeroot session so ownership faked during
+            //    assemble() ends up in the archive; ownership is only forced to root when
+            //    there is no fake (or real) root to take it from.
+            std::string tar = findInPath("tar");
+            std::string zstd = findInPath("zstd");
+            if (tar.empty() || zstd.empty())
             {
-                std::ostringstream oss;
-                oss << "\"" << path << "\"";
-                return oss.str();
-            };
-
-            std::ostringstream cmd;
-            cmd << "cd " << shellEscape(packagedir)
-                << " && tar --owner=0 --group=0 "
-                << "--transform='s|^\\./metadata\\.yaml$|metadata.yaml|' "
-                << "--transform=\"s|^\\./hooks|hooks|\" "
-                << "--transform='s|^\\./|files/|' "
-                << "-cf - ."
-                << " | zstd --ultra --long -22 -T0 -v" // Added zstd compression, added multi core compression (4/20/25)
-                << " > " << shellEscape(outputFile);
+                log_error("tar and zstd are required to create " + outputFile);
+                return false;
+            }
 
-            log_message("Running tar command:\n" + cmd.str());
+            ProcessSpec tarSpec;
+            tarSpec.env = Environment::current();
+            tarSpec.argv = {tar, "-C", packagedir};
+            if (!useFakeroot && geteuid() != 0)
+            {
+                tarSpec.argv.insert(tarSpec.argv.end(), {"--owner=0", "--group=0"});
+            }
+            tarSpec.argv.insert(tarSpec.argv.end(),
+                                {"--transform=s|^\\./metadata\\.yaml$|metadata.yaml|",
+                                 "--transform=s|^\\./hooks|hooks|",
+                                 "--transform=s|^\\./|files/|",
+                                 "-cf", "-", "."});
+            if (useFakeroot && !fakerootSession.wrap(tarSpec))
+            {
+                return false;
+            }
 
-            int ret = std::system(cmd.str().c_str());
-            if (ret != 0)
+            ProcessSpec zstdSpec;
+            zstdSpec.env = Environment::current();
+            zstdSpec.argv = {zstd, "--ultra", "--long", "-22", "-T0", "-v"}; // Added zstd compression, added multi core compression (4/20/25)
+
+            std::string cmdLine;
+            for (const auto &arg : tarSpec.argv)
+                cmdLine += arg + " ";
+            cmdLine += "|";
+            for (const auto &arg : zstdSpec.argv)
+                cmdLine += " " + arg;
+            log_message("Running tar command:\n" + cmdLine + " > " + outputFile);
+
+            int outFd = ::open(outputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            int pipeFds[2];
+            if (outFd < 0 || ::pipe2(pipeFds, O_CLOEXEC) != 0)
+            {
+                log_error("Could not open " + outputFile + ": " + strerror(errno));
+                if (outFd >= 0)
+                    ::close(outFd);
+                return false;
+            }
+            tarSpec.fds = {{pipeFds[1], 1}};
+            zstdSpec.fds = {{pipeFds[0], 0}, {outFd, 1}};
+
+            TraceSpan compressSpan("package", "tar|zstd");
+            auto start = std::chrono::steady_clock::now();
+            std::string tarError, zstdError;
+            pid_t tarPid = spawnProcess(tarSpec, tarError);
+            pid_t zstdPid = spawnProcess(zstdSpec, zstdError);
+            ::close(pipeFds[0]);
+            ::close(pipeFds[1]);
+            ::close(outFd);
+
+            ProcessResult tarResult, zstdResult;
+            bool tarOk = tarPid > 0 && waitProcess(tarPid, tarResult) && tarResult.succeeded();
+            bool zstdOk = zstdPid > 0 && waitProcess(zstdPid, zstdResult) && zstdResult.succeeded();
+            if (usage)
+            {
+                *usage = tarResult;
+                usage->accumulate(zstdResult);
+                usage->wallTime = std::chrono::steady_clock::now() - start;
+            }
+            if (!tarOk || !zstdOk)
             {
-                log_error("tar|zstd command failed with exit code " + std::to_string(ret));
+                std::string why = !tarOk ? (tarError.empty() ? "tar exited with status " + std::to_string(tarResult.status) : tarError)
+                                         : (zstdError.empty() ? "zstd exited with status " + std::to_string(zstdResult.status) : zstdError);
+                log_error("tar|zstd command failed: " + why);
                 return false;
             }
 
@@ -1426,36 +7604,86 @@ namespace Starpack
                 log_message("Removed directory: " + pkgsDir.string());
             }
 
-            // 2) Remove downloaded archives and clones, plus their extracted dirs
-            const std::vector<std::string> archiveExts = {
-                ".tar.xz", ".tar.gz", ".tar.bz2", ".tgz", ".tbz2", ".zip"};
-
+            // 2) Remove downloaded archives and clones, plus whatever the archives
+            //    extracted according to their stamps
             for (const auto &pathStr : intermediatePaths)
             {
+                ExtractionStamp stamp;
+                if (readExtractionStamp((starbuildDir / pathStr).string(), stamp))
+                {
+                    for (const auto &entry : stamp.created)
+                    {
+                        fs::path extracted = starbuildDir / entry;
+                        std::error_code ec;
+                        if (fs::exists(fs::symlink_status(extracted, ec)))
+                        {
+                            fs::remove_all(extracted, ec);
+                            log_message("Removed extracted entry: " + extracted.string());
+                        }
+                    }
+                }
+
                 fs::path p = starbuildDir / pathStr;
                 if (fs::exists(p))
                 {
                     fs::remove_all(p);
                     log_message("Removed: " + p.string());
                 }
+            }
+
+            // 3) Remove the extraction stamps and the saved fakeroot state
+            fs::path stampsDir = starbuildDir / ".starpack-stamps";
+            if (fs::exists(stampsDir))
+            {
+                fs::remove_all(stampsDir);
+            }
+            std::error_code ec;
+            fs::remove(starbuildDir / ".starpack-fakeroot", ec);
+            fs::remove_all(starbuildDir / ".starpack-pgo", ec);
+        }
 
-                // 3) Try to strip off a known archive suffix and remove that dir too
-                for (auto &ext : archiveExts)
+        /**
+         * @brief Makes the STARBUILD directory's files visible in an in-memory build tree.
+         *
+         * Scripts expect local sources, patches and downloads next to the extracted
+         * sources in $srcdir, so each of them gets a symlink in workDir. Our own output
+         * (packages/, logs/, .starpack files, reports, state) is left out.
+         *
+         * With sourcesOnly, only the sources and downloads (intermediatePaths) are
+         * linked, not whatever else the directory holds: a build/ left by an earlier
+         * run must not be written through from a scratch tree.
+         */
+        static void linkIntoWorkDir(const fs::path &starbuildDir, const fs::path &workDir,
+                                    const std::vector<std::string> &intermediatePaths,
+                                    bool sourcesOnly = false)
+        {
+            std::vector<fs::path> targets;
+            std::error_code ec;
+            if (!sourcesOnly)
+            {
+                for (const auto &entry : fs::directory_iterator(starbuildDir, ec))
                 {
-                    if (pathStr.size() > ext.size() &&
-                        pathStr.substr(pathStr.size() - ext.size()) == ext)
-                    {
-                        std::string base = pathStr.substr(0, pathStr.size() - ext.size());
-                        fs::path extractedDir = starbuildDir / base;
-                        if (fs::exists(extractedDir) && fs::is_directory(extractedDir))
-                        {
-                            fs::remove_all(extractedDir);
-                            log_message("Removed extracted dir: " + extractedDir.string());
-                        }
-                        break;
-                    }
+                    std::string name = entry.path().filename().string();
+                    if (name == "packages" || name == "logs" || name.rfind(".starpack", 0) == 0 ||
+                        entry.path().extension() == ".starpack" ||
+                        (name.size() > 11 && name.compare(name.size() - 11, 11, ".build.json") == 0))
+                        continue;
+                    targets.push_back(entry.path());
                 }
             }
+            // Downloads land in the current directory, which need not be the STARBUILD's
+            for (const auto &p : intermediatePaths)
+                targets.push_back(fs::absolute(p, ec));
+
+            for (const auto &target : targets)
+            {
+                fs::path link = workDir / target.filename();
+                if (fs::exists(fs::symlink_status(link, ec)) || !fs::exists(fs::symlink_status(target, ec)))
+                    continue;
+                fs::create_symlink(target, link, ec);
+                if (ec)
+                    log_warning("Could not link " + target.string() + " into " + workDir.string() + ": " + ec.message());
+            }
         }
 
         /**
@@ -1479,6 +7707,20 @@ namespace Starpack
             // Determine the directory
             fs::path sbDir = absolute(starbuildPath).parent_path();
 
+            // Timeline of the whole build, written on the way out (after all spans closed)
+            struct TraceGuard
+            {
+                ~TraceGuard()
+                {
+                    if (tracer.enabled())
+                        tracer.write(traceFile);
+                }
+            } traceGuard;
+            if (!traceFile.empty())
+                tracer.enable();
+            TraceSpan buildSpan("build", "createPackage");
+            buildSpan.arg("starbuild", starbuildPath);
+
             // Try to pick up a previous run
             bool isResuming = loadResumeState(sbDir);
             bool skipping = isResuming;
@@ -1502,6 +7744,8 @@ namespace Starpack
             std::unordered_map<std::string, std::string> assemble_functions;
             std::vector<std::pair<std::string, std::string>> symlinkPairs;
             std::vector<std::string> customFunctions;
+            std::unordered_map<std::string, ExtractOptions> extractOptions;
+            std::unordered_map<std::string, std::string> recipeOptions;
 
             // 1) Parse the STARBUILD file
             if (!parse_starbuild(
@@ -1523,7 +7767,9 @@ namespace Starpack
                     generic_assemble_function,
                     assemble_functions,
                     symlinkPairs,
-                    customFunctions))
+                    customFunctions,
+                    extractOptions,
+                    recipeOptions))
             {
                 log_error("Failed to parse STARBUILD: " + starbuildPath);
                 return false;
@@ -1537,30 +7783,236 @@ namespace Starpack
 
             // Directory containing STARBUILD
             path starbuildDir = absolute(starbuildPath).parent_path();
+
+            buildJobs = computeBuildJobs();
+
+            // Compiler flags for every phase
+            auto profileOpt = recipeOptions.find("build_profile");
+            if (!buildProfile.select(profileOpt != recipeOptions.end() ? profileOpt->second : ""))
+            {
+                return false;
+            }
+
+            // Man and info pages: --man-compression, else the STARBUILD's man_compression, else gzip
+            auto manOpt = recipeOptions.find("man_compression");
+            const std::string manFormat = !manCompression.empty()         ? manCompression
+                                          : manOpt != recipeOptions.end() ? manOpt->second
+                                                                          : "gzip";
+            const ManCompressor *manCompressor = findManCompressor(manFormat);
+            if (!manCompressor && manFormat != "none")
+            {
+                log_warning("Unknown man page compression \"" + manFormat + "\"; using gzip.");
+                manCompressor = findManCompressor("gzip");
+            }
+
+            // Per-phase resource usage, written next to the .starpack files however the build ends
+            buildReport.reset(package_names[0], package_version, buildJobs);
+            bool buildSucceeded = false;
+            struct BuildReportGuard
+            {
+                fs::path path;
+                const bool &succeeded;
+                ~BuildReportGuard() { buildReport.write(path, succeeded); }
+            } buildReportGuard{starbuildDir / (package_names[0] + "-" + package_version + ".build.json"), buildSucceeded};
+
+            // With --tmpfs-build, sources are extracted and built in memory; $srcdir points there
+            struct TmpfsGuard
+            {
+                const bool &succeeded;
+                ~TmpfsGuard() { tmpfsWorkDir.finish(succeeded); }
+            } tmpfsGuard{buildSucceeded};
+            fs::path workDir = ".";
             std::string srcdir = starbuildDir.string();
+            if (tmpfsBuild && tmpfsWorkDir.setup(package_names[0], starbuildDir, sources))
+            {
+                workDir = tmpfsWorkDir.path();
+                srcdir = workDir.string();
+                if (isResuming)
+                {
+                    log_message("Not resuming: the previous build tree did not survive in memory.");
+                    isResuming = skipping = false;
+                    clearResumeState();
+                }
+            }
+
+            // Runs one build phase and records its resource usage in the report
+            auto runPhase = [&](const char *phase, const std::string &script,
+                                const std::string &pkgdir, const std::string &name)
+            {
+                PhaseContext context;
+                context.logPath = starbuildDir / "logs" / (name + "-" + package_version + "-" + phase + ".log.zst");
+
+                // Limits: timeout_<phase> / timeout / hang_timeout in the STARBUILD win over the flags
+                // (the PGO passes "pgo-<phase>" share the limits of <phase>)
+                std::string basePhase = phase;
+                basePhase = basePhase.substr(basePhase.rfind('-') + 1);
+                unsigned timeout = phaseTimeoutSeconds, hangTimeout = hangTimeoutSeconds;
+                for (const std::string &key : {std::string("timeout"), "timeout_" + basePhase, std::string("hang_timeout")})
+                {
+                    auto it = recipeOptions.find(key);
+                    if (it != recipeOptions.end() &&
+                        !parseDuration(it->second, key == "hang_timeout" ? hangTimeout : timeout))
+                    {
+                        log_warning("Ignoring invalid " + key + "=\"" + it->second + "\" in STARBUILD.");
+                    }
+                }
+                context.timeout = std::chrono::seconds(timeout);
+                context.hangTimeout = std::chrono::seconds(hangTimeout);
+                if (fs::path(srcdir) != starbuildDir)
+                    context.workingDirectory = srcdir;
+                TraceSpan span("phase", phase);
+                span.arg("package", name);
+
+                // In its own cgroup the phase starts from zero; otherwise diff our group
+                BuildCgroups::Phase cgroup;
+                bool inCgroup = buildCgroups.createPhase(name + "-" + phase, cgroup);
+                context.cgroupProcsFd = cgroup.procsFd;
+                CgroupSample before = inCgroup ? CgroupSample{} : CgroupSample::take();
+                before.valid = before.valid || inCgroup;
+
+                bool ok = runWithBash(script, pkgdir, srcdir, name, package_version, customFunctions, &context);
+                CgroupSample after = inCgroup ? buildCgroups.finishPhase(cgroup) : CgroupSample::take();
+                buildReport.record(name, phase, context.result, before, after, context.abortReason);
+                tmpfsWorkDir.sample();
+                return ok;
+            };
+
+            // Join a jobserver we were started under, or run our own if asked to
+            struct JobServerGuard
+            {
+                ~JobServerGuard() { jobServer.close(); }
+            } jobServerGuard;
+            if (!jobServer.joinInherited() && useJobserver)
+            {
+                if (!jobserverFifo.empty())
+                    jobServer.openShared(jobserverFifo, buildJobs);
+                else
+                    jobServer.createPrivate(buildJobs);
+            }
+
+            // Compiler cache; statistics go into the report before it is written
+            struct CompilerCacheGuard
+            {
+                ~CompilerCacheGuard()
+                {
+                    if (compilerCache.active())
+                        buildReport.setCompilerCache(compilerCache.finish());
+                }
+            } compilerCacheGuard;
+            if (useCompilerCache && !recipeFlag(recipeOptions, "compiler_cache", true))
+                log_message("STARBUILD sets compiler_cache=\"" + recipeOptions["compiler_cache"] + "\"; building without a compiler cache.");
+            else if (useCompilerCache)
+                compilerCache.setup(package_names[0], srcdir);
+
+            // Phase cgroups: set up before any phase runs, torn down on the way out
+            struct CgroupGuard
+            {
+                ~CgroupGuard() { buildCgroups.stop(); }
+            } cgroupGuard;
+            if (useCgroups)
+            {
+                buildCgroups.start();
+            }
+
+            // One fakeroot daemon for all phases and packaging of this build
+            struct FakerootGuard
+            {
+                ~FakerootGuard() { fakerootSession.stop(); }
+            } fakerootGuard;
+            if (useFakeroot)
+            {
+                fakerootSession.start(starbuildDir / ".starpack-fakeroot");
+            }
 
             // 2) Fetch sources (downloads, clones, local copies) and store intermediate paths for cleanup
             std::vector<std::string> intermediatePaths;
-            if (!fetchSources(sources, intermediatePaths, starbuildDir))
+            if (!fetchSources(sources, intermediatePaths, starbuildDir, extractOptions, workDir))
             {
                 log_error("fetchSources() failed.");
                 return false;
             }
+            if (tmpfsWorkDir.active())
+            {
+                linkIntoWorkDir(starbuildDir, workDir, intermediatePaths);
+            }
+
+            // 2b) PGO: without a cached profile for this version, build an instrumented
+            //     copy in a scratch tree, train it with train() (or verify()) and merge
+            //     the profile. The real build below then compiles against it.
+            struct PgoGuard
+            {
+                ~PgoGuard() { pgoBuild.stop(); }
+            } pgoGuard;
+            bool compileWillRun = !skipping || currentState.phase == "prepare" || currentState.phase == "compile";
+            if (recipeFlag(recipeOptions, "pgo", false))
+            {
+                static const std::regex re_train(R"(^\s*train\s*\(\))");
+                bool hasTrain = std::any_of(customFunctions.begin(), customFunctions.end(),
+                                            [](const std::string &fn)
+                                            { return std::regex_search(fn, re_train); });
+                const std::string trainScript = hasTrain ? "train\n" : verify_function;
+                fs::path pgoDir = fs::path(srcdir) / ".starpack-pgo";
+
+                if (pgoBuild.setup(package_names[0], package_version))
+                {
+                    log_message("PGO: using the cached profile in " + pgoBuild.profileDir().string() + ".");
+                    pgoBuild.use(srcdir);
+                }
+                else if (!compileWillRun)
+                {
+                    log_message("PGO: compile() already ran in the resumed build; no profile to collect.");
+                }
+                else if (trim(trainScript).empty())
+                {
+                    log_warning("pgo=\"true\", but there is no train() or verify() to collect a profile with; building without PGO.");
+                }
+                else
+                {
+                    log_message("PGO: building an instrumented copy to collect a profile...");
+                    std::error_code ec;
+                    fs::remove_all(pgoDir, ec);
+                    fs::path tree = pgoDir / "tree";
+                    fs::create_directories(tree, ec);
+                    std::vector<std::string> treePaths;
+                    bool ok = fetchSources(sources, treePaths, starbuildDir, extractOptions, tree);
+                    if (ok)
+                        linkIntoWorkDir(starbuildDir, tree, intermediatePaths, true);
+
+                    // Phases see the scratch tree as $srcdir and run inside it
+                    std::string buildSrcdir = srcdir;
+                    srcdir = tree.string();
+                    pgoBuild.generate(pgoDir / "profiles", tree);
+                    ok = ok &&
+                         runPhase("pgo-prepare", prepare_function, srcdir, package_names[0]) &&
+                         runPhase("pgo-compile", compile_function, srcdir, package_names[0]) &&
+                         runPhase("pgo-train", trainScript, srcdir, package_names[0]);
+                    srcdir = buildSrcdir;
+                    if (!ok)
+                    {
+                        log_error("PGO: the instrumented build or its training run failed.");
+                        return false;
+                    }
+
+                    if (pgoBuild.merge())
+                        pgoBuild.use(srcdir);
+                    else
+                        log_warning("PGO: building without a profile.");
+                    fs::remove_all(pgoDir, ec);
+                }
+            }
 
             // 3a) PREPARE
             if (!skipping || currentState.phase == "prepare")
             {
                 skipping = false;
                 currentState = {"prepare", 0};
-                saveResumeState(sbDir);
+                if (!tmpfsWorkDir.active())
+                    saveResumeState(sbDir);
 
                 log_message("Running prepare()...");
-                if (!runWithBash(prepare_function,
-                                 sbDir.string(), // pkgdir == srcdir for global steps
-                                 sbDir.string(),
-                                 package_names[0],
-                                 package_version,
-                                 customFunctions))
+                if (!runPhase("prepare", prepare_function,
+                              srcdir, // pkgdir == srcdir for global steps
+                              package_names[0]))
                 {
                     log_error("prepare() failed.");
                     return false;
@@ -1572,15 +8024,13 @@ namespace Starpack
             {
                 skipping = false;
                 currentState = {"compile", 0};
-                saveResumeState(sbDir);
+                if (!tmpfsWorkDir.active())
+                    saveResumeState(sbDir);
 
                 log_message("Running compile()...");
-                if (!runWithBash(compile_function,
-                                 sbDir.string(),
-                                 sbDir.string(),
-                                 package_names[0],
-                                 package_version,
-                                 customFunctions))
+                if (!runPhase("compile", compile_function,
+                              srcdir,
+                              package_names[0]))
                 {
                     log_error("compile() failed.");
                     return false;
@@ -1592,15 +8042,13 @@ namespace Starpack
             {
                 skipping = false;
                 currentState = {"verify", 0};
-                saveResumeState(sbDir);
+                if (!tmpfsWorkDir.active())
+                    saveResumeState(sbDir);
 
                 log_message("Running verify()...");
-                if (!runWithBash(verify_function,
-                                 sbDir.string(),
-                                 sbDir.string(),
-                                 package_names[0],
-                                 package_version,
-                                 customFunctions))
+                if (!runPhase("verify", verify_function,
+                              srcdir,
+                              package_names[0]))
                 {
                     log_error("verify() failed.");
                     return false;
@@ -1614,9 +8062,11 @@ namespace Starpack
             for (size_t i = 0; i < package_names.size(); i++)
             {
                 const std::string &pkgName = package_names[i];
+                TraceSpan packageSpan("package", "subpackage");
+                packageSpan.arg("name", pkgName);
 
                 // Staging directory "packages/pkgName/files"
-                fs::path pkgDir = starbuildDir / "packages" / pkgName / "files";
+                fs::path pkgDir = fs::path(srcdir) / "packages" / pkgName / "files";
                 fs::create_directories(pkgDir);
                 std::string pkg_packagedir = pkgDir.string();
 
@@ -1686,22 +8136,12 @@ namespace Starpack
                 if (it != assemble_functions.end())
                 {
                     // assemble_<pkg>()
-                    assembleResult = runWithBash(it->second,
-                                                 pkg_packagedir,
-                                                 srcdir,
-                                                 pkgName,
-                                                 package_version,
-                                                 customFunctions);
+                    assembleResult = runPhase("assemble", it->second, pkg_packagedir, pkgName);
                 }
                 else if (!generic_assemble_function.empty())
                 {
                     // generic assemble()
-                    assembleResult = runWithBash(generic_assemble_function,
-                                                 pkg_packagedir,
-                                                 srcdir,
-                                                 pkgName,
-                                                 package_version,
-                                                 customFunctions);
+                    assembleResult = runPhase("assemble", generic_assemble_function, pkg_packagedir, pkgName);
                 }
                 else
                 {
@@ -1715,12 +8155,25 @@ namespace Starpack
                     return false;
                 }
 
-                // 4b) strip binaries, remove .la / .a files
-                if (!postProcessFiles(pkg_packagedir))
+                // 4b) strip binaries (splitting off their debug info into
+                //     "packages/<pkgName>-debug/files"), remove .la / .a files
+                fs::path debugDir;
+                if (splitDebug)
+                {
+                    debugDir = fs::path(srcdir) / "packages" / (pkgName + "-debug") / "files";
+                    std::error_code ec;
+                    fs::remove_all(debugDir, ec);
+                    fs::create_directories(debugDir, ec);
+                }
+                PackageInventory inventory;
+                if (!inventory.scan(pkgDir) || !postProcessFiles(inventory, debugDir, manCompressor))
                 {
                     log_error("Post-processing failed for package " + pkgName);
                     return false;
                 }
+                if (!noDedup)
+                    hardlinkDuplicates(inventory);
+                SharedLibraries sharedLibraries = scanSharedLibraries(inventory);
 
                 // Build final dependencies array: global + subpackage
                 std::vector<std::string> finalDeps = dependencies;
@@ -1768,6 +8221,14 @@ namespace Starpack
                 pushSeq(gives, "gives");
                 pushSeq(optional_dependencies, "optional_dependencies");
 
+                if (buildProfile.active())
+                    metadata["build_profile"] = buildProfile.describe();
+
+                pushSeq({sharedLibraries.provides.begin(), sharedLibraries.provides.end()}, "so_provides");
+                pushSeq({sharedLibraries.needs.begin(), sharedLibraries.needs.end()}, "so_dependencies");
+
+                metadata["installed_size"] = inventory.installedBytes();
+
                 // Turn the YAML node into a string
                 YAML::Emitter emitter;
                 emitter << metadata;
@@ -1778,9 +8239,11 @@ namespace Starpack
 
                 // Final .starpack file named "pkgName-version.starpack" in the starbuild directory
                 std::string outputFile =
-                    (fs::path(srcdir) / (pkgName + "-" + package_version + ".starpack")).string();
+                    (starbuildDir / (pkgName + "-" + package_version + ".starpack")).string();
 
                 // Tar+zstd the subpackage
+                ProcessResult packagingUsage;
+                CgroupSample packagingBefore = CgroupSample::take();
                 bool ok = packageStarpack(
                     starbuildDir.string(),
                     pkgDir.string(),
@@ -1788,15 +8251,58 @@ namespace Starpack
                     outputFile,
                     symlinkPairs,
                     pkgName,
-                    isSinglePackage);
+                    isSinglePackage,
+                    &packagingUsage);
+                buildReport.record(pkgName, "packaging", packagingUsage, packagingBefore, CgroupSample::take());
                 if (!ok)
                 {
                     log_error("Packaging failed for package " + pkgName);
                     return false;
                 }
+
+                // 4c) "<pkgName>-debug" package with the split-off debug information
+                std::error_code debugEc;
+                if (!debugDir.empty() && !fs::is_empty(debugDir, debugEc))
+                {
+                    const std::string debugName = pkgName + "-debug";
+                    YAML::Node debugMetadata;
+                    debugMetadata["name"] = debugName;
+                    debugMetadata["version"] = package_version;
+                    debugMetadata["description"] = "Detached debug information for " + pkgName;
+                    YAML::Node debugDeps(YAML::NodeType::Sequence);
+                    debugDeps.push_back(pkgName + ">=" + package_version);
+                    debugMetadata["dependencies"] = debugDeps;
+                    PackageInventory debugInventory;
+                    if (debugInventory.scan(debugDir))
+                        debugMetadata["installed_size"] = debugInventory.installedBytes();
+                    YAML::Emitter debugEmitter;
+                    debugEmitter << debugMetadata;
+
+                    ProcessResult debugUsage;
+                    CgroupSample debugBefore = CgroupSample::take();
+                    ok = packageStarpack(
+                        starbuildDir.string(),
+                        debugDir.string(),
+                        debugEmitter.c_str(),
+                        (starbuildDir / (debugName + "-" + package_version + ".starpack")).string(),
+                        {},
+                        debugName,
+                        false,
+                        &debugUsage);
+                    buildReport.record(debugName, "packaging", debugUsage, debugBefore, CgroupSample::take());
+                    if (!ok)
+                    {
+                        log_error("Packaging failed for package " + debugName);
+                        return false;
+                    }
+                }
             }
 
             log_message("All steps complete. Final .starpack archive(s) have been created.");
+            buildSucceeded = true;
+
+            // Let faked write its state before cleanup may remove it
+            fakerootSession.stop();
 
             // If user wants to do a cleanup pass
             if (clean)
@@ -1897,10 +8403,150 @@ int main(int argc, char *argv[])
         {
             localNoStrip = true;
         }
+        else if (arg == "--no-dedup")
+        {
+            Starpack::CreateStarpack::noDedup = true;
+        }
         else if (arg == "--no-fakeroot")
         {
             noFakeroot = true;
         }
+        else if (arg == "--trace" || arg.rfind("--trace=", 0) == 0)
+        {
+            std::string value;
+            size_t eq = arg.find('=');
+            if (eq != std::string::npos)
+                value = arg.substr(eq + 1);
+            else if (i + 1 < argc)
+                value = argv[++i];
+
+            if (value.empty())
+            {
+                std::cerr << "--trace requires an output file\n";
+                return 1;
+            }
+            Starpack::CreateStarpack::traceFile = value;
+        }
+        else if (arg == "--cgroup")
+        {
+            Starpack::CreateStarpack::useCgroups = true;
+        }
+        else if (arg.rfind("--memory-max=", 0) == 0 || arg.rfind("--memory-high=", 0) == 0 ||
+                 arg.rfind("--cpu-max=", 0) == 0 || arg.rfind("--pids-max=", 0) == 0)
+        {
+            namespace CS = Starpack::CreateStarpack;
+            std::string value = arg.substr(arg.find('=') + 1);
+            std::string name = arg.substr(0, arg.find('='));
+            (name == "--memory-max"    ? CS::cgroupMemoryMax
+             : name == "--memory-high" ? CS::cgroupMemoryHigh
+             : name == "--cpu-max"     ? CS::cgroupCpuMax
+                                       : CS::cgroupPidsMax) = value;
+            CS::useCgroups = true;
+        }
+        else if (arg == "--phase-timeout" || arg.rfind("--phase-timeout=", 0) == 0 ||
+                 arg == "--hang-timeout" || arg.rfind("--hang-timeout=", 0) == 0)
+        {
+            bool isPhase = arg.rfind("--phase-timeout", 0) == 0;
+            std::string value;
+            size_t eq = arg.find('=');
+            if (eq != std::string::npos)
+                value = arg.substr(eq + 1);
+            else if (i + 1 < argc)
+                value = argv[++i];
+
+            unsigned seconds = 0;
+            if (!Starpack::CreateStarpack::parseDuration(value, seconds))
+            {
+                std::cerr << "Invalid duration for " << arg << ": '" << value << "' (e.g. 90s, 45m, 6h)\n";
+                return 1;
+            }
+            (isPhase ? Starpack::CreateStarpack::phaseTimeoutSeconds
+                     : Starpack::CreateStarpack::hangTimeoutSeconds) = seconds;
+        }
+        else if (arg == "--ccache")
+        {
+            Starpack::CreateStarpack::useCompilerCache = true;
+        }
+        else if (arg.rfind("--ccache-dir=", 0) == 0 || arg.rfind("--ccache-size=", 0) == 0)
+        {
+            std::string value = arg.substr(arg.find('=') + 1);
+            (arg.rfind("--ccache-dir=", 0) == 0 ? Starpack::CreateStarpack::compilerCacheDir
+                                                : Starpack::CreateStarpack::compilerCacheSize) = value;
+            Starpack::CreateStarpack::useCompilerCache = true;
+        }
+        else if (arg.rfind("--config=", 0) == 0)
+        {
+            Starpack::CreateStarpack::buildConfigFile = arg.substr(9);
+        }
+        else if (arg.rfind("--build-profile=", 0) == 0)
+        {
+            Starpack::CreateStarpack::buildProfileName = arg.substr(16);
+        }
+        else if (arg == "--split-debug" || arg.rfind("--split-debug=", 0) == 0)
+        {
+            std::string value = arg.size() > 14 ? arg.substr(14) : "";
+            if (!value.empty() && value != "zstd" && value != "zlib" && value != "none")
+            {
+                std::cerr << "Invalid value for --split-debug: '" << value << "' (zstd, zlib or none)\n";
+                return 1;
+            }
+            Starpack::CreateStarpack::splitDebug = true;
+            Starpack::CreateStarpack::debugCompression = value == "none" ? "" : value;
+        }
+        else if (arg.rfind("--man-compression=", 0) == 0)
+        {
+            std::string value = arg.substr(18);
+            if (value != "none" && !Starpack::CreateStarpack::findManCompressor(value))
+            {
+                std::cerr << "Invalid value for --man-compression: '" << value << "' (gzip, xz, zstd, bzip2 or none)\n";
+                return 1;
+            }
+            Starpack::CreateStarpack::manCompression = value;
+        }
+        else if (arg == "--tmpfs-build")
+        {
+            Starpack::CreateStarpack::tmpfsBuild = true;
+        }
+        else if (arg == "--no-tee")
+        {
+            Starpack::CreateStarpack::teePhaseOutput = false;
+        }
+        else if (arg == "--log-tail" || arg.rfind("--log-tail=", 0) == 0)
+        {
+            std::string value;
+            size_t eq = arg.find('=');
+            if (eq != std::string::npos)
+                value = arg.substr(eq + 1);
+            else if (i + 1 < argc)
+                value = argv[++i];
+            Starpack::CreateStarpack::logTailLines = static_cast<unsigned>(std::strtoul(value.c_str(), nullptr, 10));
+        }
+        else if (arg == "--jobserver" || arg.rfind("--jobserver=", 0) == 0)
+        {
+            Starpack::CreateStarpack::useJobserver = true;
+            if (arg.rfind("--jobserver=", 0) == 0)
+                Starpack::CreateStarpack::jobserverFifo = arg.substr(std::string("--jobserver=").size());
+        }
+        else if (arg == "--jobs" || arg.rfind("--jobs=", 0) == 0 ||
+                 arg == "--mem-per-job" || arg.rfind("--mem-per-job=", 0) == 0)
+        {
+            bool isJobs = arg.rfind("--jobs", 0) == 0;
+            std::string value;
+            size_t eq = arg.find('=');
+            if (eq != std::string::npos)
+                value = arg.substr(eq + 1);
+            else if (i + 1 < argc)
+                value = argv[++i];
+
+            unsigned long n = std::strtoul(value.c_str(), nullptr, 10);
+            if (n == 0)
+            {
+                std::cerr << "Invalid value for " << arg << ": '" << value << "'\n";
+                return 1;
+            }
+            (isJobs ? Starpack::CreateStarpack::jobsOverride
+                    : Starpack::CreateStarpack::memoryPerJobMiB) = static_cast<unsigned>(n);
+        }
         else if (arg.rfind("--", 0) == 0)
         {
             // ignore unknown --foo flags